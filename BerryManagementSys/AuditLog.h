@@ -0,0 +1,298 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+// Asynchronous audit log of user sessions and circulation.
+//
+// record() copies an event and its timestamp into a bounded lock-free ring buffer (a Vyukov
+// style queue: every slot carries a sequence number, producers claim slots with one CAS) and
+// returns; it never blocks and never makes a system call. An event whose fields do not fit one
+// slot claims up to maxSlots consecutive slots with the same CAS; fields longer than that, or
+// past the fourth, are cut and the line is marked [truncated]. A background thread drains the ring
+// every flushInterval, formats the events and writes each batch with one fwrite and flush. The
+// log is rotated to path.1, path.2 ... once it grows past maxFileBytes. If the ring is full the
+// event is dropped and counted, and the drop count is written to the log.
+class AuditLog {
+private:
+    static const size_t textSize = 96;
+    static const size_t maxFields = 4;
+    static const size_t maxSlots = 8;
+
+    // The first slot of an event holds its header and the start of the text, the slots after it
+    // only continue the text
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> sequence;
+        int64_t time;
+        const char* event;
+        uint8_t fieldCount;
+        uint8_t slotCount;
+        bool truncated;
+        uint16_t lengths[maxFields];
+        char text[textSize];
+    };
+
+    // Function to copy the text of the event at pos from offset on into out, across its slots
+    void readText(uint64_t pos, size_t offset, size_t length, std::string& out) const {
+        while (length > 0) {
+            const Slot& slot = slots[(pos + offset / textSize) & mask];
+            size_t piece = std::min(length, textSize - offset % textSize);
+            out.append(slot.text + offset % textSize, piece);
+            offset += piece;
+            length -= piece;
+        }
+    }
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask = 0;
+    alignas(64) std::atomic<uint64_t> enqueuePos{ 0 };
+    alignas(64) uint64_t dequeuePos = 0;
+    std::atomic<uint64_t> droppedEvents{ 0 };
+    uint64_t reportedDrops = 0;
+    std::atomic<bool> active{ false };
+
+    std::string path;
+    FILE* file = nullptr;
+    uint64_t fileBytes = 0;
+    std::string batch;
+    std::thread writer;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    static void formatTime(int64_t nanoseconds, std::string& out) {
+        std::time_t seconds = static_cast<std::time_t>(nanoseconds / 1000000000);
+        std::tm local{};
+#ifdef _WIN32
+        localtime_s(&local, &seconds);
+#else
+        localtime_r(&seconds, &local);
+#endif
+        char stamp[40];
+        size_t length = std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+        std::snprintf(stamp + length, sizeof(stamp) - length, ".%06d", static_cast<int>(nanoseconds / 1000 % 1000000));
+        out += stamp;
+    }
+
+    // Function to format and write every published event, run by the writer thread only
+    void drain() {
+        batch.clear();
+        for (;;) {
+            Slot& slot = slots[dequeuePos & mask];
+            if (slot.sequence.load(std::memory_order_acquire) != dequeuePos + 1) {
+                break;
+            }
+            formatTime(slot.time, batch);
+            batch += ' ';
+            batch += slot.event;
+            size_t offset = 0;
+            for (uint8_t i = 0; i < slot.fieldCount; i++) {
+                size_t start = batch.size() + 1;
+                batch += ' ';
+                readText(dequeuePos, offset, slot.lengths[i], batch);
+                if (std::string_view(batch).substr(start).find(' ') != std::string_view::npos) {
+                    batch.insert(start, 1, '"');
+                    batch += '"';
+                }
+                offset += slot.lengths[i];
+            }
+            if (slot.truncated) {
+                batch += " [truncated]";
+            }
+            batch += '\n';
+            // The head slot was published last, so the whole event is read before any slot of it
+            // is handed back
+            uint64_t slotCount = slot.slotCount;
+            for (uint64_t i = 0; i < slotCount; i++) {
+                slots[(dequeuePos + i) & mask].sequence.store(dequeuePos + i + mask + 1, std::memory_order_release);
+            }
+            dequeuePos += slotCount;
+        }
+        uint64_t drops = droppedEvents.load(std::memory_order_relaxed);
+        if (drops != reportedDrops) {
+            formatTime(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count(), batch);
+            batch += " DROPPED " + std::to_string(drops - reportedDrops) + " events, the audit buffer was full\n";
+            reportedDrops = drops;
+        }
+        if (batch.empty() || !file) {
+            return;
+        }
+        std::fwrite(batch.data(), 1, batch.size(), file);
+        std::fflush(file);
+        fileBytes += batch.size();
+        if (fileBytes >= maxFileBytes) {
+            rotate();
+        }
+    }
+
+    // Function to shift path.1 ... to path.2 ... and start a new log, the oldest file is dropped. If
+    // the new log cannot be opened file stays null and later batches are not written
+    void rotate() {
+        if (file) {
+            std::fclose(file);
+        }
+        std::error_code ec;
+        for (int i = keepFiles - 1; i >= 1; i--) {
+            std::string from = path + "." + std::to_string(i);
+            if (std::filesystem::exists(from, ec)) {
+                std::filesystem::rename(from, path + "." + std::to_string(i + 1), ec);
+            }
+        }
+        if (keepFiles > 0) {
+            std::filesystem::rename(path, path + ".1", ec);
+        }
+        else {
+            std::filesystem::remove(path, ec);
+        }
+        file = std::fopen(path.c_str(), "ab");
+        fileBytes = 0;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        while (!stopping) {
+            wake.wait_for(lock, flushInterval);
+            lock.unlock();
+            drain();
+            lock.lock();
+        }
+        lock.unlock();
+        drain();
+    }
+
+public:
+    // Size at which the log is rotated, and how many rotated files are kept
+    uint64_t maxFileBytes = 8 * 1024 * 1024;
+    int keepFiles = 3;
+    std::chrono::milliseconds flushInterval{ 20 };
+
+    AuditLog() = default;
+    ~AuditLog() { close(); }
+    AuditLog(const AuditLog&) = delete;
+    AuditLog& operator=(const AuditLog&) = delete;
+
+    // Function to start logging to a file with a ring of capacity events (a power of two)
+    bool open(const std::string& fileName, size_t capacity = 16384) {
+        close();
+        path = fileName;
+        file = std::fopen(path.c_str(), "ab");
+        if (!file) {
+            return false;
+        }
+        std::error_code ec;
+        auto size = std::filesystem::file_size(path, ec);
+        fileBytes = ec ? 0 : size;
+        slots.reset(new Slot[capacity]);
+        mask = capacity - 1;
+        for (size_t i = 0; i < capacity; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos = 0;
+        stopping = false;
+        writer = std::thread([this] { run(); });
+        active.store(true, std::memory_order_release);
+        return true;
+    }
+
+    // Function to write every queued event and stop the writer thread
+    void close() {
+        if (!active.exchange(false)) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+        if (file) {
+            std::fclose(file);
+            file = nullptr;
+        }
+    }
+
+    bool isOpen() const { return active.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return droppedEvents.load(std::memory_order_relaxed); }
+
+    // Function to queue an event (a string literal such as "CHECKOUT") with up to four fields,
+    // stamped with the current time. Fields are cut to fit maxSlots slots, and the event is
+    // marked truncated if they were. Safe to call from any number of threads; returns false if
+    // the log is closed or the event was dropped
+    bool record(const char* event, std::initializer_list<std::string_view> fields) {
+        if (!active.load(std::memory_order_acquire)) {
+            return false;
+        }
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        size_t fieldCount = std::min(fields.size(), maxFields);
+        size_t textBytes = 0;
+        for (auto field = fields.begin(); field != fields.begin() + fieldCount; ++field) {
+            textBytes += field->size();
+        }
+        size_t capacity = std::min(maxSlots, mask + 1) * textSize;
+        bool truncated = fields.size() > maxFields || textBytes > capacity;
+        uint64_t slotCount = std::max<size_t>(1, (std::min(textBytes, capacity) + textSize - 1) / textSize);
+
+        // Slots are handed back in order, so once the last slot of the run is free all are
+        uint64_t pos = enqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            uint64_t last = pos + slotCount - 1;
+            uint64_t sequence = slots[last & mask].sequence.load(std::memory_order_acquire);
+            if (sequence == last) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + slotCount, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (sequence < last) {
+                droppedEvents.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        Slot* slot = &slots[pos & mask];
+        slot->time = now;
+        slot->event = event;
+        slot->fieldCount = static_cast<uint8_t>(fieldCount);
+        slot->slotCount = static_cast<uint8_t>(slotCount);
+        slot->truncated = truncated;
+        size_t offset = 0;
+        size_t i = 0;
+        for (auto field = fields.begin(); field != fields.begin() + fieldCount; ++field, ++i) {
+            size_t length = std::min(field->size(), capacity - offset);
+            for (size_t copied = 0; copied < length;) {
+                size_t at = offset + copied;
+                size_t piece = std::min(length - copied, textSize - at % textSize);
+                std::memcpy(slots[(pos + at / textSize) & mask].text + at % textSize, field->data() + copied, piece);
+                copied += piece;
+            }
+            slot->lengths[i] = static_cast<uint16_t>(length);
+            offset += length;
+        }
+        // The head is published last, the writer reads the whole event once it sees the head
+        for (uint64_t k = slotCount - 1; k > 0; k--) {
+            slots[(pos + k) & mask].sequence.store(pos + k + 1, std::memory_order_release);
+        }
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        // Every half ring of slots wakes the writer early so a burst does not fill the ring
+        uint64_t half = (mask >> 1) + 1;
+        if ((pos + slotCount) / half != pos / half) {
+            wake.notify_one();
+        }
+        return true;
+    }
+};
@@ -2,24 +2,83 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <array>
+#include <deque>
 #include <ctime>
 #include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <sstream>
+#include <future>
+#include <string_view>
+#include <span>
+#include <cstdint>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <limits>
+#include <random>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <shared_mutex>
+#include <thread>
+#include <cstdlib>
+#include <new>
 #include "json.hpp"
+#include "MappedFile.h"
+#include "Journal.h"
+#include "Snapshot.h"
+#include "LoanTable.h"
+#include "SearchIndex.h"
+#include "SortedView.h"
+#include "SlotMap.h"
+#include "StorePolicies.h"
+#include "ShardedMutex.h"
+#include "FdStream.h"
+#include "AuditLog.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+#include "CirculationLog.h"
+#include "Bitmap.h"
+#include "StringPool.h"
+#include "SearchCache.h"
+#include "CatalogImage.h"
+#include "JsonExport.h"
+#ifndef _WIN32
+#include <csignal>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 using json = nlohmann::json;
 // Define a constant welcome message, style inspired from C++ lvl 1 class last semester
 const string welcome = " Welcome to the Berry Management System ";
 
-// Define struct for books
+// Define struct for books. The strings live in the library's string pool, which outlives
+// the books, so a book owns no heap memory and the books of one author share its name
 struct Book {
-    string title;
-    string author;
+    string_view title;
+    string_view author;
+    // Lowercase title and author, pooled too: two books match ignoring case exactly when
+    // these point at the same bytes
+    string_view titleKey;
+    string_view authorKey;
     bool checkedOut;
+    BookId id = NoId;
 
     // Constructors
-    Book(const string& _title, const string& _author, bool _checkedOut) : title(_title), author(_author), checkedOut(_checkedOut) {}
-    Book() : title(""), author(""), checkedOut(false) {}
+    Book(string_view _title, string_view _author, string_view _titleKey, string_view _authorKey, bool _checkedOut)
+        : title(_title), author(_author), titleKey(_titleKey), authorKey(_authorKey), checkedOut(_checkedOut) {}
+    Book() : checkedOut(false) {}
+
+    // Loan flag access for code that runs while other desks check books out and in
+    bool isCheckedOut() const { return atomic_ref<bool>(const_cast<bool&>(checkedOut)).load(memory_order_relaxed); }
+    void setCheckedOut(bool value) { atomic_ref<bool>(checkedOut).store(value, memory_order_relaxed); }
 };
 
 // Overload output stream operator for Book
@@ -28,6 +87,328 @@ ostream& operator<<(ostream& os, const Book& book) {
     return os;
 }
 
+// Case-insensitive hash and equality so lookups can fold case without building lowered copies
+struct CaseInsensitiveHash {
+    using is_transparent = void;
+    static const uint64_t seed = 14695981039346656037ull; // FNV-1a
+    static uint64_t extend(uint64_t hash, string_view str) {
+        for (char c : str) {
+            hash ^= static_cast<unsigned char>(tolower(static_cast<unsigned char>(c)));
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+    size_t operator()(string_view str) const { return static_cast<size_t>(extend(seed, str)); }
+};
+
+struct CaseInsensitiveEqual {
+    using is_transparent = void;
+    bool operator()(string_view a, string_view b) const {
+        return a.size() == b.size() && equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+            return tolower(static_cast<unsigned char>(x)) == tolower(static_cast<unsigned char>(y));
+            });
+    }
+};
+
+// A patron's first and last name. The patron index is keyed by "first\nlast" and can be probed
+// with a PatronName, ignoring case, so a lookup never builds a key
+struct PatronName {
+    string_view first, last;
+
+    string key() const {
+        string joined;
+        joined.reserve(first.size() + 1 + last.size());
+        return joined.append(first).append(1, '\n').append(last);
+    }
+};
+
+struct PatronNameHash {
+    using is_transparent = void;
+    size_t operator()(string_view key) const { return CaseInsensitiveHash()(key); }
+    size_t operator()(const PatronName& name) const {
+        uint64_t hash = CaseInsensitiveHash::extend(CaseInsensitiveHash::seed, name.first);
+        return static_cast<size_t>(CaseInsensitiveHash::extend(CaseInsensitiveHash::extend(hash, "\n"), name.last));
+    }
+};
+
+struct PatronNameEqual {
+    using is_transparent = void;
+    bool operator()(string_view a, string_view b) const { return CaseInsensitiveEqual()(a, b); }
+    bool operator()(string_view key, const PatronName& name) const {
+        size_t split = name.first.size();
+        return key.size() == split + 1 + name.last.size() && key[split] == '\n'
+            && CaseInsensitiveEqual()(key.substr(0, split), name.first) && CaseInsensitiveEqual()(key.substr(split + 1), name.last);
+    }
+    bool operator()(const PatronName& name, string_view key) const { return (*this)(key, name); }
+};
+
+// Iterator over a mapped file for the JSON parser that publishes how far it has read every
+// 64 KB, so another thread can show the progress of a long load
+struct ProgressIterator {
+    using iterator_category = forward_iterator_tag;
+    using value_type = char;
+    using difference_type = ptrdiff_t;
+    using pointer = const char*;
+    using reference = const char&;
+
+    // Where the file starts and how far it has been read
+    struct Progress {
+        const char* base;
+        atomic<uint64_t>& bytes;
+    };
+
+    const char* at;
+    const Progress* progress;
+
+    reference operator*() const { return *at; }
+    ProgressIterator& operator++() {
+        if ((reinterpret_cast<uintptr_t>(++at) & 0xFFFF) == 0) [[unlikely]] {
+            progress->bytes.store(static_cast<uint64_t>(at - progress->base), memory_order_relaxed);
+        }
+        return *this;
+    }
+    ProgressIterator operator++(int) {
+        ProgressIterator before = *this;
+        ++*this;
+        return before;
+    }
+    bool operator==(const ProgressIterator& other) const { return at == other.at; }
+};
+
+// SAX handler that turns a JSON array of {"Author", "Title", "CheckedOut"} records into
+// calls of onBook(title, author, checkedOut) without building a json DOM. Unknown keys and
+// nested values are skipped.
+template<typename OnBook>
+class BookSaxHandler : public nlohmann::json_sax<json> {
+private:
+    OnBook onBook;
+    int depth = 0;
+    bool skipping = false;
+    int skipDepth = 0;
+    enum class Field { None, Title, Author, CheckedOut } field = Field::None;
+    string_t title, author;
+    bool checkedOut = false, hasTitle = false, hasAuthor = false;
+
+    // Nested values inside a record are not part of the format, skip them whole
+    bool enter() {
+        depth++;
+        if (!skipping && depth > 2) {
+            skipping = true;
+            skipDepth = depth;
+        }
+        return true;
+    }
+    bool leave() {
+        if (skipping && depth == skipDepth) {
+            skipping = false;
+        }
+        depth--;
+        return true;
+    }
+    bool scalar() {
+        field = Field::None;
+        return true;
+    }
+
+public:
+    string_t errorMessage;
+
+    explicit BookSaxHandler(OnBook _onBook) : onBook(move(_onBook)) {}
+
+    bool null() override { return scalar(); }
+    bool boolean(bool val) override {
+        if (!skipping && depth == 2 && field == Field::CheckedOut) {
+            checkedOut = val;
+        }
+        return scalar();
+    }
+    bool number_integer(number_integer_t) override { return scalar(); }
+    bool number_unsigned(number_unsigned_t) override { return scalar(); }
+    bool number_float(number_float_t, const string_t&) override { return scalar(); }
+    bool binary(binary_t&) override { return scalar(); }
+    bool string(string_t& val) override {
+        if (!skipping && depth == 2) {
+            if (field == Field::Title) {
+                title = move(val);
+                hasTitle = true;
+            }
+            else if (field == Field::Author) {
+                author = move(val);
+                hasAuthor = true;
+            }
+        }
+        return scalar();
+    }
+    bool key(string_t& val) override {
+        if (!skipping && depth == 2) {
+            field = val == "Title" ? Field::Title : val == "Author" ? Field::Author : val == "CheckedOut" ? Field::CheckedOut : Field::None;
+        }
+        return true;
+    }
+    bool start_object(size_t) override {
+        enter();
+        if (!skipping && depth == 2) {
+            hasTitle = hasAuthor = checkedOut = false;
+        }
+        return true;
+    }
+    bool end_object() override {
+        if (!skipping && depth == 2 && hasTitle && hasAuthor) {
+            onBook(title, author, checkedOut);
+        }
+        field = Field::None;
+        return leave();
+    }
+    bool start_array(size_t) override { return enter(); }
+    bool end_array() override {
+        field = Field::None;
+        return leave();
+    }
+    bool parse_error(size_t, const std::string&, const nlohmann::detail::exception& ex) override {
+        errorMessage = ex.what();
+        return false;
+    }
+};
+
+// A book record parsed from a catalog file, not yet in the library
+struct ImportedBook {
+    string title;
+    string author;
+    bool checkedOut;
+};
+
+// Books parsed from one catalog file, records repeated within the file already dropped
+struct ParsedCatalog {
+    string fileName;
+    vector<ImportedBook> books;
+    size_t records = 0;
+    string error;
+};
+
+// Outcome of importing one catalog file
+struct ImportFileReport {
+    string fileName;
+    size_t records = 0, added = 0;
+    string error;
+};
+
+// Function to tidy a title or author from an export: surrounding whitespace is trimmed, runs of
+// whitespace become one space and control characters are dropped
+string normalizeField(const string& field) {
+    string result;
+    result.reserve(field.size());
+    bool pendingSpace = false;
+    for (char c : field) {
+        unsigned char u = static_cast<unsigned char>(c);
+        if (isspace(u)) {
+            pendingSpace = !result.empty();
+            continue;
+        }
+        if (iscntrl(u)) {
+            continue;
+        }
+        if (pendingSpace) {
+            result += ' ';
+            pendingSpace = false;
+        }
+        result += c;
+    }
+    return result;
+}
+
+// Function to parse and normalize one catalog file. Touches no library state, so any number
+// of files can be parsed at once
+ParsedCatalog parseCatalogFile(const string& fileName) {
+    ParsedCatalog catalog;
+    catalog.fileName = fileName;
+    MappedFile file;
+    if (!file.open(fileName)) {
+        catalog.error = "unable to open " + fileName;
+        return catalog;
+    }
+    // Same title and author ignoring case is the same book, as in the library's indexes
+    unordered_set<string, CaseInsensitiveHash, CaseInsensitiveEqual> seen;
+    auto onBook = [&catalog, &seen](string& title, string& author, bool checkedOut) {
+        catalog.records++;
+        string cleanTitle = normalizeField(title), cleanAuthor = normalizeField(author);
+        if (cleanTitle.empty() || cleanAuthor.empty() || !seen.insert(cleanTitle + '\n' + cleanAuthor).second) {
+            return;
+        }
+        catalog.books.push_back({ move(cleanTitle), move(cleanAuthor), checkedOut });
+    };
+    BookSaxHandler<decltype(onBook)> handler(onBook);
+    if (!json::sax_parse(file.begin(), file.end(), &handler)) {
+        catalog.error = handler.errorMessage;
+    }
+    return catalog;
+}
+
+// Function to expand directories into the *.json files they hold, in name order. Other paths
+// are kept as given
+vector<string> expandCatalogPaths(const vector<string>& paths) {
+    vector<string> files;
+    for (const string& path : paths) {
+        error_code ec;
+        if (!filesystem::is_directory(path, ec)) {
+            files.push_back(path);
+            continue;
+        }
+        vector<string> found;
+        for (const auto& entry : filesystem::directory_iterator(path, ec)) {
+            if (entry.is_regular_file(ec) && entry.path().extension() == ".json") {
+                found.push_back(entry.path().string());
+            }
+        }
+        sort(found.begin(), found.end());
+        files.insert(files.end(), found.begin(), found.end());
+    }
+    return files;
+}
+
+// Function to print one line per imported file and the totals
+void printImportReports(const vector<ImportFileReport>& reports, double seconds, ostream& out) {
+    size_t records = 0, added = 0, failed = 0;
+    for (const ImportFileReport& report : reports) {
+        if (!report.error.empty()) {
+            out << "- " << report.fileName << ": error: " << report.error << "\n";
+            failed++;
+            continue;
+        }
+        out << "- " << report.fileName << ": " << report.records << " records, " << report.added << " added, "
+            << report.records - report.added << " duplicates skipped\n";
+        records += report.records;
+        added += report.added;
+    }
+    out << "Imported " << reports.size() - failed << " of " << reports.size() << " files: " << records << " records, "
+        << added << " added in " << fixed << setprecision(3) << seconds << " s ("
+        << static_cast<uint64_t>(seconds > 0 ? records / seconds : 0) << " records/sec)\n";
+}
+
+// Function to format a Unix time as a UTC date, YYYY-MM-DD
+string formatDate(int64_t unixTime) {
+    time_t when = static_cast<time_t>(unixTime);
+    char date[16];
+    strftime(date, sizeof(date), "%Y-%m-%d", gmtime(&when));
+    return date;
+}
+
+// Function to read a YYYY-MM-DD date as the last second of that day (UTC). Returns false if it
+// is not a valid date
+bool parseDueDate(const string& text, int64_t& unixTime) {
+    int year, month, day;
+    char dash1, dash2;
+    istringstream in(text);
+    if (!(in >> year >> dash1 >> month >> dash2 >> day) || dash1 != '-' || dash2 != '-' || in.peek() != EOF) {
+        return false;
+    }
+    chrono::year_month_day date{ chrono::year(year), chrono::month(static_cast<unsigned>(month)), chrono::day(static_cast<unsigned>(day)) };
+    if (month < 1 || day < 1 || !date.ok()) {
+        return false;
+    }
+    unixTime = chrono::duration_cast<chrono::seconds>((chrono::sys_days(date) + chrono::days(1)).time_since_epoch()).count() - 1;
+    return true;
+}
+
 // Define base class Person
 class Person {
 protected:
@@ -39,444 +420,3423 @@ public:
     Person(const string& _firstName, const string& _lastName) : firstName(_firstName), lastName(_lastName) {}
 
     // Getters
-    string getFirstName() const { return firstName; }
-    string getLastName() const { return lastName; }
+    const string& getFirstName() const { return firstName; }
+    const string& getLastName() const { return lastName; }
 };
 
-// Define a derived class Patron from Person
+// Define a derived class Patron from Person. A patron's loans live in the library's LoanTable
+// under the patron's ID. Patrons are move-only: the registry owns each one and moves it when
+// its store compacts, a patron is never duplicated
 class Patron : public Person {
 private:
-    vector<Book*> checkedOutBooks;
+    PatronId id;
 
 public:
-    // Constructor
-    Patron(const string& _firstName, const string& _lastName) : Person(_firstName, _lastName) {}
+    // Constructors, an empty patron fills the slot of a removed one
+    Patron(const string& _firstName, const string& _lastName, PatronId _id) : Person(_firstName, _lastName), id(_id) {}
+    Patron() : Person("", ""), id(NoId) {}
+    Patron(Patron&&) = default;
+    Patron& operator=(Patron&&) = default;
+    Patron(const Patron&) = delete;
+    Patron& operator=(const Patron&) = delete;
 
     // Getters
-    const vector<Book*>& getCheckedOutBooks() const { return checkedOutBooks; }
+    PatronId getId() const { return id; }
+};
 
-    // Destructor
-    ~Patron() {
-        for (Book* book : checkedOutBooks) {
-            delete book;
-        }
-        checkedOutBooks.clear();
+// Outcome of a library operation, the interactive commands turn these into messages
+enum class OpStatus { Ok, BookNotFound, PatronNotFound, AlreadyCheckedOut, NotCheckedOut, HeldByOtherPatron, JournalFailing };
+
+// Function to turn an operation status into a message for batch output
+const char* statusMessage(OpStatus status) {
+    switch (status) {
+    case OpStatus::Ok: return "ok";
+    case OpStatus::BookNotFound: return "book not found";
+    case OpStatus::PatronNotFound: return "patron not found";
+    case OpStatus::AlreadyCheckedOut: return "book is already checked out";
+    case OpStatus::NotCheckedOut: return "book is not checked out";
+    case OpStatus::HeldByOtherPatron: return "book is checked out by another patron";
+    case OpStatus::JournalFailing: return "changes cannot be saved, the journal is failing";
     }
+    return "unknown error";
+}
 
-    // Functions specific to Patron class
-    void checkOutBook(Book* book) {
-        Book* newBook = new Book(*book);
-        checkedOutBooks.push_back(newBook);
-    }
-    void returnBook(const string& title) {
-        auto it = find_if(checkedOutBooks.begin(), checkedOutBooks.end(), [&title](Book* book) {
-            return book->title == title;
-            });
-        if (it != checkedOutBooks.end()) {
-            delete* it;
-            checkedOutBooks.erase(it);
-        }
-    }
+// Steps of the startup load, in order. The catalog is complete once the stage is Ready
+enum class LoadStage : uint8_t { Recovering, ReadingFile, AddingTestData, Ready };
+
+// One checkout or return of a bulk circulation batch, due as in Library::checkOut
+struct CirculationRequest {
+    string firstName, lastName, title;
+    CirculationEvent action;
+    int64_t due = 0;
 };
 
-// Define template class Library
-template<typename BookContainer, typename PatronContainer, typename PersonContainer>
+// Record types written to the write-ahead journal. LoadFile and ImportFile are no longer
+// written, bulk loads are checkpointed, but journals that have them are still replayed
+enum class JournalOp : uint8_t { LoadFile = 1, AddBook, RemoveBook, CheckOut, Return, AddPatron, RemovePatron, ImportFile, OverdueNotices };
+
+// Orders the book list can be printed in
+enum class BookOrder { Added, Title, Author };
+
+// Function to read the peak resident set size of the process in KB, 0 where unsupported
+size_t peakRssKb() {
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        return static_cast<size_t>(usage.ru_maxrss);
+    }
+#endif
+    return 0;
+}
+
+// Function to print the size, speed and memory of a JSON export
+void printExportReport(const jsonexport::Report& report, ostream& out) {
+    double megabytes = report.bytes / (1024.0 * 1024.0);
+    out << "-" << report.books << " books, " << fixed << setprecision(1) << megabytes << " MB in " << report.seconds * 1000 << " ms ("
+        << (report.seconds > 0 ? megabytes / report.seconds : 0) << " MB/s), export buffers " << report.peakBufferBytes / (1024.0 * 1024.0)
+        << " MB, process peak " << peakRssKb() / 1024.0 << " MB\n";
+}
+
+// Define template class Library. Each container role is a compile-time policy, see
+// StorePolicies.h for the concepts and the shipped book stores
+template<HandleStore<Book> BookContainer, HandleStore<Patron> PatronContainer, AppendStore<Person> PersonContainer>
 class Library {
 private:
     BookContainer books;
     PatronContainer patrons;
     PersonContainer people;
-    time_t now = time(0);
-    struct tm* local_time = localtime(&now);
-    char* date_time = asctime(local_time);
-
-public:
-    // Function to convert string to lowercase
-    string lower(string toBeLower) {
-        for (char& c : toBeLower) {
-            c = tolower(c);
+    // Session and circulation events, written to user_log.txt by a background thread
+    AuditLog audit;
+
+    // Active loans, and the store handle of each book and patron ID. IDs are never reused, so
+    // they stay valid across removals while the handle of a removed book or patron goes stale
+    LoanTable loans;
+    vector<SlotHandle> bookSlots, patronSlots;
+    BookId nextBookId = 0;
+    PatronId nextPatronId = 0;
+
+    // Patron registry: IDs by name ignoring case. Names may repeat, the patron registered first
+    // answers to a shared name
+    unordered_multimap<string, PatronId, PatronNameHash, PatronNameEqual> patronIndex;
+
+    // One bit per book ID for the books in the catalog and for the books checked out, so counts
+    // and "available only" lists never read the book records. liveBooks changes under the
+    // exclusive catalogLock. checkedOutBooks changes there too when books are placed or removed,
+    // and under the shared catalogLock plus loanMutex for loans, so readers hold both locks
+    Bitmap liveBooks, checkedOutBooks;
+
+    // Titles and authors of the books placed, with their lowercase forms. Grows only under the
+    // exclusive catalogLock and keeps a removed book's strings until a checkpoint finds most of
+    // the pool dead and copies the live strings into a new one (see compactStrings). Code that
+    // reads book strings after releasing catalogLock holds on to the pool it read them from
+    shared_ptr<StringPool> strings = make_shared<StringPool>();
+
+    // Case-folded indexes over book IDs, kept in sync by every mutation. The keys are the
+    // pooled lowercase forms, so an entry holds no string of its own. A title maps to its
+    // first copy and the IDs of any further copies in ascending order, so removing a copy costs
+    // the copies of its title. The many titles with one copy have no list
+    struct TitleEntry {
+        BookId first;
+        unique_ptr<vector<BookId>> others;
+        bool single() const { return !others || others->empty(); }
+    };
+    unordered_map<string_view, TitleEntry, CaseInsensitiveHash, CaseInsensitiveEqual> titleIndex;
+    unordered_map<string_view, vector<BookId>, CaseInsensitiveHash, CaseInsensitiveEqual> authorIndex;
+
+    // Trigram index for partial and fuzzy title and author searches, keyed by book ID, and the
+    // ranked results of recent queries. Cached results are checked against the index's stamp of
+    // their query, so adding or removing a book only retires the queries it could show up in.
+    // Checkouts and returns do not change rankings; a hit's loan state is read when it is shown
+    SearchIndex searchIndex;
+    mutable SearchCache searchCache{ 4096 };
+    // Set while a snapshot whose saved index is taken over is loaded, and the snapshot mapping
+    // that the taken over posting lists point into until they change
+    bool deferSearch = false;
+    unique_ptr<snapshot::Reader> mappedCheckpoint;
+
+    // Several desks may share one library. catalogLock is held shared by searches and by
+    // circulation, and exclusively by anything that adds, removes or moves books or patrons.
+    // Circulation holds it as an UpdateLock, so it also waits while a file load steps aside
+    // for searches. Checkouts and returns serialize on loanMutex only for the few instructions
+    // that test and flip a book's flag and update the loan table, so a copy can never go to two
+    // desks. The lock order is catalogLock, loanMutex, journalMutex
+    mutable ShardedSharedMutex catalogLock;
+    chrono::milliseconds loadStepAside{ 2 };
+    mutable mutex loanMutex;
+    mutex journalMutex;
+
+    // Loan period of checkouts without a due date, and the background thread that moves loans
+    // past their due date to the overdue list every overdueInterval and audits a notice for each
+    int64_t loanPeriod = 21 * 24 * 60 * 60;
+    chrono::seconds overdueInterval{ 60 };
+    thread overdueTicker;
+    mutex tickerMutex;
+    condition_variable tickerWake;
+    bool tickerStopping = false;
+
+    // Each loan gets one overdue notice, also across restarts. An advance that audits notices
+    // journals the time it advanced to; the loans in the table at that point and due by then
+    // have had theirs. Recovery replays the last such time, and the books lent after it, and the
+    // first advance after it skips the rest. Guarded by loanMutex
+    int64_t noticedThrough = 0;
+    unordered_set<BookId> lentSinceNotice;
+    bool skipNoticed = false;
+
+    // Latency histograms and counters, dumped to statsFile every statsInterval
+    mutable Stats stats;
+    string statsFile = "berry_stats.json";
+    chrono::seconds statsInterval{ 10 };
+    atomic<int64_t> nextStatsDump{ 0 };
+
+    // Progress of the startup load, which may run on a background thread while the first
+    // commands are answered (see startLibraryInBackground). A file being read reports its bytes
+    // read so far; the books it added so far are in the catalog and can be searched
+    atomic<LoadStage> loadStage{ LoadStage::Ready };
+    atomic<uint64_t> loadFileBytes{ 0 }, loadedBytes{ 0 }, loadedRecords{ 0 };
+    chrono::steady_clock::time_point loadStart;
+    atomic<int64_t> loadMicros{ 0 }, firstPromptMicros{ 0 };
+    mutable mutex loadMutex;
+    condition_variable loadChanged;
+
+    // Read-only catalog image for query replicas (see CatalogImage.h), republished to imageFile
+    // at most every imageInterval when the catalog or its loans changed. Publishing is off while
+    // imageFile is empty
+    string imageFile;
+    chrono::milliseconds imageInterval{ 1000 };
+    atomic<int64_t> nextImagePublish{ 0 };
+    atomic<uint64_t> catalogChanges{ 1 }, publishedChanges{ 0 };
+    uint64_t imageGeneration = 0;
+    mutex publishMutex;
+
+    // Function to estimate the memory held by the lookup indexes, the caller holds catalogLock
+    size_t indexMemoryBytes() const {
+        size_t bytes = searchIndex.memoryBytes();
+        // Hash nodes hold a next pointer, the cached hash, the key and the value
+        bytes += titleIndex.bucket_count() * sizeof(void*) + titleIndex.size() * (2 * sizeof(void*) + sizeof(string_view) + sizeof(TitleEntry));
+        for (const auto& entry : titleIndex) {
+            if (entry.second.others) {
+                bytes += sizeof(vector<BookId>) + entry.second.others->capacity() * sizeof(BookId);
+            }
         }
-        return toBeLower;
+        bytes += authorIndex.bucket_count() * sizeof(void*) + authorIndex.size() * (2 * sizeof(void*) + sizeof(string_view) + sizeof(vector<BookId>));
+        for (const auto& entry : authorIndex) {
+            bytes += entry.second.capacity() * sizeof(BookId);
+        }
+        // A red-black tree node is four words of links and color plus the ID
+        bytes += (titleOrder.size() + authorOrder.size()) * (4 * sizeof(void*) + sizeof(BookId));
+        bytes += (bookSlots.capacity() + patronSlots.capacity()) * sizeof(SlotHandle);
+        bytes += patronIndex.bucket_count() * sizeof(void*) + patronIndex.size() * (2 * sizeof(void*) + sizeof(string) + sizeof(PatronId));
+        bytes += liveBooks.memoryBytes() + checkedOutBooks.memoryBytes();
+        return bytes;
     }
-    // Funciton to detect whitespace in string
-    bool hasWhitespace(const string& str) {
-        return any_of(str.begin(), str.end(), [](char c) { 
-            if (isspace(c)) {
-            cout << "Error: Whitespaces are not allowed in the name.\n";
+
+    // Sorted views by title and by author. Keys are read through the ID table so the views
+    // need no update when books move; a bulk load defers them and catches up at the end
+    struct TitleKey {
+        const Library* library;
+        string_view operator()(BookId id) const { return library->books[library->bookSlots[id]].title; }
+    };
+    struct AuthorKey {
+        const Library* library;
+        string_view operator()(BookId id) const { return library->books[library->bookSlots[id]].author; }
+    };
+    SortedView<TitleKey> titleOrder{ TitleKey{ this } };
+    SortedView<AuthorKey> authorOrder{ AuthorKey{ this } };
+    bool deferViews = false;
+    BookOrder listOrder = BookOrder::Added;
+
+    // Function to take a book out of the indexes. If it was the first copy of its title the
+    // next copy, if any, takes its place
+    void unindexBook(const Book& book) {
+        auto titleIt = titleIndex.find(book.titleKey);
+        TitleEntry& entry = titleIt->second;
+        if (entry.first != book.id) {
+            entry.others->erase(find(entry.others->begin(), entry.others->end(), book.id));
+        }
+        else if (entry.single()) {
+            titleIndex.erase(titleIt);
+        }
+        else {
+            entry.first = entry.others->front();
+            entry.others->erase(entry.others->begin());
+        }
+        auto authorIt = authorIndex.find(book.authorKey);
+        vector<BookId>& ids = authorIt->second;
+        ids.erase(find(ids.begin(), ids.end(), book.id));
+        if (ids.empty()) {
+            authorIndex.erase(authorIt);
         }
-        return isspace(c); });
     }
-    
-    // Function to log user name with date, this mimics the librarian/user
-    void logUserName(const string& firstName, const string& lastName) {
-        people.push_back(Person(firstName, lastName));
-        ofstream logFile("user_log.txt", ios::app);
-        if (logFile.is_open()) {
-            logFile << "User: " << firstName << " " << lastName << " - Date: " << date_time << "\n";
-            logFile.close();
+
+    // Function to append a book, give it the next ID and index it. Its strings are pooled: a
+    // title or author that is in the indexes already reuses the lowercase key and, if the case
+    // matches, the string of a book that has it, so copies of a title and the books of an
+    // author store their strings once. The first copy of a title wins the title index
+    Book& placeBook(string_view title, string_view author, bool checkedOut) {
+        string_view knownTitle, knownAuthor;
+        auto titleIt = titleIndex.find(title);
+        if (titleIt != titleIndex.end()) {
+            knownTitle = bookById(titleIt->second.first)->title;
+        }
+        auto authorIt = authorIndex.find(author);
+        if (authorIt != authorIndex.end()) {
+            knownAuthor = bookById(authorIt->second.front())->author;
+        }
+        string_view titleKey = titleIt != titleIndex.end() ? titleIt->first : strings->storeFolded(title);
+        string_view authorKey = authorIt != authorIndex.end() ? authorIt->first : strings->storeFolded(author);
+        auto pooled = [this](string_view text, string_view key, string_view known) {
+            return text == key ? key : text == known ? known : strings->store(text);
+        };
+
+        SlotHandle handle = books.insert(Book(pooled(title, titleKey, knownTitle), pooled(author, authorKey, knownAuthor),
+            titleKey, authorKey, checkedOut));
+        Book& book = *books.get(handle);
+        book.id = nextBookId++;
+        bookSlots.push_back(handle);
+        liveBooks.assign(book.id, true);
+        checkedOutBooks.assign(book.id, checkedOut);
+        // New IDs are the largest yet, so a further copy keeps the list ascending
+        if (titleIt == titleIndex.end()) {
+            titleIndex.emplace(titleKey, TitleEntry{ book.id, nullptr });
         }
         else {
-            cerr << "Unable to open log file for writing.\n";
+            unique_ptr<vector<BookId>>& others = titleIt->second.others;
+            if (!others) {
+                others = make_unique<vector<BookId>>();
+            }
+            others->push_back(book.id);
+        }
+        if (authorIt == authorIndex.end()) {
+            authorIt = authorIndex.emplace(authorKey, vector<BookId>()).first;
+        }
+        authorIt->second.push_back(book.id);
+        if (!deferSearch) {
+            searchIndex.add(book.id, book.title, book.author);
         }
+        if (!deferViews) {
+            titleOrder.insert(book.id);
+            authorOrder.insert(book.id);
+        }
+        return book;
     }
 
-    // Function to search books by author
-    void searchBooksByAuthor() {
-        string authorFirstName, authorLastName;
-        cout << "Enter author first name: ";
-        getline(cin, authorFirstName);
-        if (hasWhitespace(authorFirstName)) { return; }
-        cout << "Enter author last name: ";
-        getline(cin, authorLastName);
-        if (hasWhitespace(authorLastName)) { return; }
+    // Function to add the books placed since firstNew to the sorted views. A batch that is a
+    // large part of the catalog rebuilds the views with a parallel sort instead
+    void catchUpViews(BookId firstNew) {
+        deferViews = false;
+        size_t added = nextBookId - firstNew;
+        if (added * 4 >= books.size()) {
+            vector<BookId> ids;
+            ids.reserve(books.size());
+            for (const Book& book : books) {
+                ids.push_back(book.id);
+            }
+            titleOrder.rebuild(ids);
+            authorOrder.rebuild(ids);
+            return;
+        }
+        for (BookId id = firstNew; id < nextBookId; id++) {
+            if (bookById(id)) {
+                titleOrder.insert(id);
+                authorOrder.insert(id);
+            }
+        }
+    }
 
-        cout << "\nRESULTS:\nBooks by author " << authorFirstName << " " << authorLastName << ":\n";
-        for (const Book& book : books) {
-            if (lower(book.author) == lower(authorFirstName) + " " + lower(authorLastName)) {
-                cout << "- " << book.title << " (";
-                if (book.checkedOut) {
-                    cout << "Checked out)\n";
-                }
-                else {
-                    cout << "Available)\n";
+    // Function to set a book's loan flag and its bit together. The caller holds loanMutex or the
+    // exclusive catalogLock
+    void markCheckedOut(Book& book, bool checkedOut) {
+        book.setCheckedOut(checkedOut);
+        checkedOutBooks.assign(book.id, checkedOut);
+    }
+
+    // Function to call onBook(book) for each of these books that is available. The bits are read
+    // under loanMutex, the books are visited after it is released. The caller holds catalogLock
+    template<typename OnBook>
+    void forEachAvailable(const vector<BookId>& ids, OnBook onBook) const {
+        vector<BookId> available;
+        {
+            lock_guard<mutex> loanGuard(loanMutex);
+            for (BookId id : ids) {
+                if (!checkedOutBooks.test(id)) {
+                    available.push_back(id);
                 }
             }
         }
+        for (BookId id : available) {
+            onBook(*bookById(id));
+        }
     }
 
-    // Function to search for a book by title
-    void searchBookByTitle() {
-        string title;
-        cout << "Enter book title: ";
-        getline(cin, title);
+    // Function to find a book by ID, nullptr if it has been removed
+    Book* bookById(BookId id) {
+        return id < bookSlots.size() ? books.get(bookSlots[id]) : nullptr;
+    }
+    const Book* bookById(BookId id) const {
+        return id < bookSlots.size() ? books.get(bookSlots[id]) : nullptr;
+    }
 
-        for (const Book& book : books) {
-            if (lower(book.title) == lower(title)) {
-                cout << "\nRESULTS:\n-Book: " << book.title << " by " << book.author << " (";
-                if (book.checkedOut) {
-                    cout << "Checked out)\n";
-                }
-                else {
-                    cout << "Available)\n";
-                }
+    // Function to rank the k best books for a query, from the cache while its stamp holds. The
+    // caller holds catalogLock
+    vector<SearchHit> rankCatalog(const string& query, size_t k) const {
+        int maxEdits = query.size() >= 8 ? 2 : 1;
+        SearchStamp stamp = searchIndex.stampOf(query, maxEdits);
+        vector<SearchHit> hits;
+        if (searchCache.find(query, k, stamp, hits)) {
+            return hits;
+        }
+        hits = searchIndex.search(query, k, maxEdits, [this](BookId id) { return bookById(id); });
+        searchCache.store(query, k, stamp, hits);
+        return hits;
+    }
+
+    // Function to check if a book with this title and author is already in the library, ignoring case
+    bool containsBook(const string& title, const string& author) const {
+        // Titles are nearly unique, so a title miss, or the author of its only copy, settles most
+        // checks without walking the author's books
+        auto titleIt = titleIndex.find(title);
+        if (titleIt == titleIndex.end()) {
+            return false;
+        }
+        if (titleIt->second.single()) {
+            return CaseInsensitiveEqual()(bookById(titleIt->second.first)->author, author);
+        }
+        auto it = authorIndex.find(author);
+        if (it == authorIndex.end()) {
+            return false;
+        }
+        return any_of(it->second.begin(), it->second.end(), [this, &title](BookId id) {
+            return CaseInsensitiveEqual()(bookById(id)->title, title);
+            });
+    }
+
+    // Function to find a book by title ignoring case, nullptr if not found
+    Book* findBookByTitle(const string& title) {
+        auto it = titleIndex.find(title);
+        return it == titleIndex.end() ? nullptr : bookById(it->second.first);
+    }
+
+    // Function to find a patron by ID, nullptr if they have been removed
+    Patron* patronById(PatronId id) {
+        return id < patronSlots.size() ? patrons.get(patronSlots[id]) : nullptr;
+    }
+    const Patron* patronById(PatronId id) const {
+        return id < patronSlots.size() ? patrons.get(patronSlots[id]) : nullptr;
+    }
+
+    // Function to find a patron by name ignoring case, nullptr if not found
+    Patron* findPatron(string_view firstName, string_view lastName) {
+        auto range = patronIndex.equal_range(PatronName{ firstName, lastName });
+        PatronId first = NoId;
+        for (auto it = range.first; it != range.second; ++it) {
+            first = min(first, it->second);
+        }
+        return first == NoId ? nullptr : patronById(first);
+    }
+
+    // Function to register a patron under the next ID
+    void placePatron(const string& firstName, const string& lastName) {
+        PatronId id = nextPatronId++;
+        patronSlots.push_back(patrons.insert(Patron(firstName, lastName, id)));
+        patronIndex.emplace(PatronName{ firstName, lastName }.key(), id);
+    }
+
+    // Write-ahead journal of every mutation. Records are staged as mutations happen and
+    // committed once per command, a checkpoint replaces the journal when it grows too large
+    Journal journal;
+    bool replaying = false;
+    // Set while the journal cannot write, changes are refused until a commit succeeds again
+    atomic<bool> journalFailing{ false };
+    string journalFile = "booksJournal.bin";
+    string checkpointFile = "library.snap";
+    uint64_t compactionBytes = 4 * 1024 * 1024;
+    // Dead string bytes a checkpoint tolerates on top of the live ones before compacting the pool
+    size_t stringSlackBytes = 1024 * 1024;
+
+    // Function to queue an audit event, replayed records were audited when they first happened
+    void auditEvent(const char* event, initializer_list<string_view> fields) {
+        if (!replaying) {
+            audit.record(event, fields);
+        }
+    }
+
+    // Checkouts and returns kept for the circulation reports, saved with every journal commit.
+    // The history's dictionary code of each book and patron ID is kept once known, guarded by
+    // loanMutex, so recording an event needs no string lookup
+    CirculationLog history;
+    string historyFile = "circulation.bin";
+    vector<uint32_t> historyBookCodes, historyPatronCodes;
+
+    // Function to add a checkout or return to the history, replayed records are in it already.
+    // The caller holds loanMutex
+    void historyEvent(CirculationEvent type, const Book& book, const Patron& patron) {
+        if (replaying) {
+            return;
+        }
+        if (book.id >= historyBookCodes.size()) {
+            historyBookCodes.resize(static_cast<size_t>(nextBookId), NoId);
+        }
+        if (historyBookCodes[book.id] == NoId) {
+            historyBookCodes[book.id] = history.bookCode(book.title, book.author);
+        }
+        if (patron.getId() >= historyPatronCodes.size()) {
+            historyPatronCodes.resize(static_cast<size_t>(nextPatronId), NoId);
+        }
+        if (historyPatronCodes[patron.getId()] == NoId) {
+            historyPatronCodes[patron.getId()] = history.patronCode(patron.getFirstName(), patron.getLastName());
+        }
+        history.record(type, historyBookCodes[book.id], historyPatronCodes[patron.getId()], time(nullptr));
+    }
+
+    // Function to move the loan clock to now and audit a notice for every loan that falls
+    // overdue, only those loans are looked at. Right after a restart the loans noticed before
+    // it are skipped. The caller holds catalogLock and loanMutex
+    void noteOverdueLoans() {
+        int64_t now = time(nullptr);
+        bool noticed = false;
+        loans.advanceClock(now, [this, &noticed](const LoanTable::Loan& loan) {
+            if (skipNoticed && loan.due <= noticedThrough && !lentSinceNotice.count(loan.book)) {
                 return;
             }
+            const Book* book = bookById(loan.book);
+            const Patron* patron = patronById(loan.patron);
+            if (book && patron) {
+                auditEvent("OVERDUE", { patron->getFirstName(), patron->getLastName(), book->title, formatDate(loan.due) });
+                noticed = true;
+            }
+            });
+        skipNoticed = false;
+        lentSinceNotice.clear();
+        if (noticed) {
+            noticedThrough = now;
+            journalNotices();
         }
-        cout << "Book not found.\n";
     }
-    
-    // Function to add a book
-    void addBook() {
-        string title, authorFirstName, authorLastName;
-        cout << "Enter the title of the book: ";
-        getline(cin, title);
-        cout << "Enter the first name of the author of the book: ";
-        getline(cin, authorFirstName);
-        if (hasWhitespace(authorFirstName)) { return; };
 
-        cout << "Enter the last name of the author of the book: ";
-        getline(cin, authorLastName);
-        if (hasWhitespace(authorLastName)) { return; }
+    // Function to journal how far overdue notices have been audited and commit it right away,
+    // it does not change the catalog. The caller holds loanMutex or the exclusive catalogLock
+    void journalNotices() {
+        if (replaying || !journal.isOpen() || noticedThrough == 0) {
+            return;
+        }
+        lock_guard<mutex> journalGuard(journalMutex);
+        journal.append(static_cast<uint8_t>(JournalOp::OverdueNotices), time(nullptr), { to_string(noticedThrough) });
+        if (!journal.commit()) {
+            journalFailing = true;
+        }
+    }
 
-        Book newBook(title, authorFirstName + " " + authorLastName, false);
-        books.push_back(newBook);
-        cout << newBook << "\nBook added to the library.\n";
+    // Function to lend a book to a patron, due at a Unix time or after the loan period when due
+    // is 0. The caller holds catalogLock and loanMutex
+    OpStatus lendBook(Book& book, const Patron& patron, const string& firstName, const string& lastName, const string& title, int64_t due) {
+        if (book.checkedOut) {
+            return OpStatus::AlreadyCheckedOut;
+        }
+        if (due == 0) {
+            due = time(nullptr) + loanPeriod;
+        }
+        markCheckedOut(book, true);
+        loans.add(book.id, patron.getId(), due);
+        if (replaying) {
+            lentSinceNotice.insert(book.id);
+        }
+        logMutation(JournalOp::CheckOut, { firstName, lastName, title, to_string(due) });
+        auditEvent("CHECKOUT", { firstName, lastName, title });
+        historyEvent(CirculationEvent::CheckOut, book, patron);
+        return OpStatus::Ok;
     }
 
-    // Function to remove a book
-    void removeBook() {
-        string title, authorFirstName, authorLastName;
-        cout << "*Case sensitive for safety\n";
-        cout << "Enter the title of the book to remove: ";
-        getline(cin, title);
-        cout << "Enter the first name of the author of the book to remove: ";
-        getline(cin, authorFirstName);
-        if (hasWhitespace(authorFirstName)) { return; };
+    // Function to take a book back from a patron. The caller holds catalogLock and loanMutex
+    OpStatus returnBook(Book& book, const Patron& patron, const string& firstName, const string& lastName, const string& title) {
+        if (!book.checkedOut) {
+            return OpStatus::NotCheckedOut;
+        }
+        // Books flagged as checked out in the catalog file have no loan and can be returned by anyone
+        uint32_t loan = loans.loanOf(book.id);
+        if (loan != NoId) {
+            if (loans.at(loan).patron != patron.getId()) {
+                return OpStatus::HeldByOtherPatron;
+            }
+            loans.remove(loan);
+        }
+        markCheckedOut(book, false);
+        logMutation(JournalOp::Return, { firstName, lastName, title });
+        auditEvent("RETURN", { firstName, lastName, title });
+        historyEvent(CirculationEvent::Return, book, patron);
+        return OpStatus::Ok;
+    }
 
-        cout << "Enter the last name of the author of the book to remove: ";
-        getline(cin, authorLastName);
-        if (hasWhitespace(authorLastName)) { return; };
+    // Function to stage a journal record, replayed records are not journaled again. Every
+    // mutation passes here, so it also marks the published catalog image out of date
+    void logMutation(JournalOp op, initializer_list<string_view> fields) {
+        catalogChanges.fetch_add(1, memory_order_relaxed);
+        if (!replaying && journal.isOpen()) {
+            lock_guard<mutex> journalGuard(journalMutex);
+            journal.append(static_cast<uint8_t>(op), time(nullptr), fields);
+            if (journal.failing()) {
+                journalFailing = true;
+            }
+        }
+    }
 
-        cout << "\nTitle: " << title << ", Author: " << authorFirstName << " " << authorLastName << endl;
+    // Function to check that a change can be journaled before it is made. A journal whose last
+    // commit failed still holds that group, so nothing more is accepted until it is written
+    bool acceptingChanges() const {
+        return replaying || !journalFailing.load(memory_order_relaxed);
+    }
 
-        auto it = find_if(books.begin(), books.end(), [&title, &authorFirstName, &authorLastName](const Book& book) {
-            return (book.title == title && book.author == authorFirstName + " " + authorLastName);
-            });
+    // Function to fold the journal into a snapshot checkpoint and start an empty journal, the
+    // caller holds catalogLock exclusively. The checkpoint names the next epoch, so if a crash
+    // comes between the two steps recovery knows the old journal is in the checkpoint and does
+    // not replay it on top. Returns false if the checkpoint was not written
+    bool checkpoint() {
+        lock_guard<mutex> journalGuard(journalMutex);
+        uint64_t epoch = journal.epoch() + 1;
+        if (!journal.commit() || !saveSnapshot(checkpointFile, epoch)) {
+            return false;
+        }
+        compactStrings();
+        if (!journal.reset(epoch)) {
+            journalFailing = true;
+            cerr << "Unable to start a new journal, changes are refused until it can be written.\n";
+        }
+        else if (noticedThrough != 0) {
+            // Every loan is in the checkpoint, so the new journal starts with how far they were noticed
+            journal.append(static_cast<uint8_t>(JournalOp::OverdueNotices), time(nullptr), { to_string(noticedThrough) });
+            journalFailing = !journal.commit();
+        }
+        return true;
+    }
 
-        if (it != books.end()) {
-            books.erase(it);
-            cout << "Has been successfully removed from the library.\n";
+    // Function to copy the strings of the books into a new pool once at least half the pool is
+    // strings of removed books, the caller holds catalogLock exclusively. Strings that books
+    // share stay shared, and the indexes are keyed by the new lowercase forms. Costs a pass over
+    // the books, which a checkpoint has just made anyway
+    void compactStrings() {
+        size_t referenced = 0;
+        for (const Book& book : books) {
+            referenced += book.title.size() + book.author.size() + book.titleKey.size() + book.authorKey.size();
+        }
+        // Shared strings are counted once per book, so this overstates what is live
+        if (strings->bytes() < 2 * referenced + stringSlackBytes) {
+            return;
+        }
+        auto compacted = make_shared<StringPool>();
+        unordered_map<const char*, string_view> moved;
+        moved.reserve(titleIndex.size() + authorIndex.size());
+        auto relocate = [&compacted, &moved](string_view text) {
+            if (text.empty()) {
+                return text;
+            }
+            auto [it, added] = moved.try_emplace(text.data());
+            if (added) {
+                it->second = compacted->store(text);
+            }
+            else if (it->second.size() != text.size()) {
+                return compacted->store(text);
+            }
+            return it->second;
+        };
+        for (BookId id = 0; id < nextBookId; id++) {
+            if (Book* book = bookById(id)) {
+                book->titleKey = relocate(book->titleKey);
+                book->authorKey = relocate(book->authorKey);
+                book->title = relocate(book->title);
+                book->author = relocate(book->author);
+            }
+        }
+        // Keys cannot change in place, the nodes move to a map of the same hash size instead
+        auto rekey = [&relocate](auto& index) {
+            remove_reference_t<decltype(index)> rekeyed(index.bucket_count());
+            while (!index.empty()) {
+                auto node = index.extract(index.begin());
+                node.key() = relocate(node.key());
+                rekeyed.insert(move(node));
+            }
+            index.swap(rekeyed);
+        };
+        rekey(titleIndex);
+        rekey(authorIndex);
+        size_t before = strings->memoryBytes();
+        strings = move(compacted);
+        cout << "-String pool compacted from " << before / 1024 << " KB to " << strings->memoryBytes() / 1024 << " KB.\n";
+    }
+
+    // Function to make the books a bulk load or import added from firstNew on durable, the
+    // caller holds catalogLock exclusively. A checkpoint stores them in one write, so recovery
+    // never depends on the source files still being there unchanged; if it cannot be written
+    // each book is journaled instead
+    void persistBulkAdd(BookId firstNew) {
+        catalogChanges.fetch_add(1, memory_order_relaxed);
+        if (replaying || !journal.isOpen() || checkpoint()) {
+            return;
+        }
+        cerr << "Unable to write checkpoint " << checkpointFile << ", journaling the added books one by one.\n";
+        for (BookId id = firstNew; id < nextBookId; id++) {
+            if (const Book* book = bookById(id)) {
+                logMutation(JournalOp::AddBook, { book->title, book->author, book->checkedOut ? "1" : "0" });
+            }
+        }
+    }
+
+    // Function to apply one replayed journal record
+    void applyJournalRecord(uint8_t op, const vector<string_view>& fields) {
+        auto field = [&fields](size_t i) { return i < fields.size() ? string(fields[i]) : string(); };
+        switch (static_cast<JournalOp>(op)) {
+        case JournalOp::LoadFile:
+            // Loads and imports are checkpointed now, these two are left by older versions
+            readFromFile(field(0));
+            break;
+        case JournalOp::AddBook:
+            insertBook(field(0), field(1), field(2) == "1");
+            break;
+        case JournalOp::RemoveBook:
+            eraseBook(field(0), field(1));
+            break;
+        case JournalOp::CheckOut:
+            // Records written before due dates were journaled get the loan period from now
+            checkOut(field(0), field(1), field(2), fields.size() > 3 ? stoll(field(3)) : 0);
+            break;
+        case JournalOp::Return:
+            checkIn(field(0), field(1), field(2));
+            break;
+        case JournalOp::AddPatron:
+            insertPatron(field(0), field(1));
+            break;
+        case JournalOp::RemovePatron:
+            erasePatron(field(0), field(1));
+            break;
+        case JournalOp::ImportFile:
+            importCatalogs({ field(0) }, 1);
+            break;
+        case JournalOp::OverdueNotices:
+            noticedThrough = stoll(field(0));
+            lentSinceNotice.clear();
+            break;
+        default:
+            cerr << "Skipping unknown journal record type " << static_cast<int>(op) << "\n";
+            break;
+        }
+    }
+
+    // Function to take over the sorted views saved in a snapshot whose book i got ID i. Returns
+    // false, with the views left for catchUpViews to rebuild, unless both are valid orders of
+    // exactly these books
+    bool restoreViews(const snapshot::Reader& image) {
+        size_t count = image.info().bookCount;
+        auto take = [count](auto& view, const uint32_t* saved) {
+            span<const BookId> ids(saved, count);
+            return all_of(ids.begin(), ids.end(), [count](BookId id) { return id < count; }) && view.assignSorted(ids);
+        };
+        if (nextBookId != count || !take(titleOrder, image.titleOrder()) || !take(authorOrder, image.authorOrder())) {
+            return false;
+        }
+        deferViews = false;
+        return true;
+    }
+
+    // Function to load the books, patrons and loans of a binary snapshot, and the epoch of the
+    // journal that follows it when it is a checkpoint. Loaded into an empty library, book i of
+    // the snapshot gets ID i, so its saved views and search index are taken over as they are:
+    // the views are checked and linked in one pass and the posting lists stay in the mapped
+    // file. The books, patrons, loans and hash indexes are still rebuilt one record at a time
+    bool loadSnapshot(const string& fileName, uint64_t& journalEpoch) {
+        auto start = chrono::steady_clock::now();
+        auto reader = make_unique<snapshot::Reader>();
+        snapshot::Reader& image = *reader;
+        if (!image.open(fileName)) {
+            cerr << "An error occurred while reading the snapshot: " << image.error << endl;
+            return false;
+        }
+        const snapshot::Header& info = image.info();
+        journalEpoch = image.journalEpoch();
+        const snapshot::Book* bookRecords = image.books();
+        const snapshot::Patron* patronRecords = image.patrons();
+
+        PatronId firstPatron = nextPatronId;
+        BookId firstNew = nextBookId;
+        bool restoreIndexes = image.hasIndexes() && firstNew == 0;
+        reserveIfSupported(books, books.size() + info.bookCount);
+        bookSlots.reserve(bookSlots.size() + info.bookCount);
+        titleIndex.reserve(books.size() + info.bookCount);
+        authorIndex.reserve(books.size() + info.bookCount);
+        deferViews = true;
+        deferSearch = restoreIndexes;
+        bool intact = true;
+        for (uint64_t i = 0; i < info.bookCount; i++) {
+            const snapshot::Book& record = bookRecords[i];
+            if (!image.valid(record.title) || !image.valid(record.author)) {
+                cerr << "An error occurred while reading the snapshot: book " << i << " is corrupt" << endl;
+                intact = false;
+                break;
+            }
+            placeBook(image.str(record.title), image.str(record.author), record.checkedOut != 0);
+        }
+        deferSearch = false;
+        // Books placed without search entries are indexed one by one if the saved index cannot
+        // be used after all
+        auto indexPlaced = [this, firstNew]() {
+            for (BookId id = firstNew; id < nextBookId; id++) {
+                searchIndex.add(id, bookById(id)->title, bookById(id)->author);
+            }
+        };
+        if (!intact && restoreIndexes) {
+            indexPlaced();
+            restoreIndexes = false;
+        }
+        if (!restoreIndexes || !restoreViews(image)) {
+            catchUpViews(firstNew);
+        }
+        if (!intact) {
+            return false;
+        }
+        if (restoreIndexes) {
+            const snapshot::GramPostings* grams = image.grams();
+            if (searchIndex.restore(nextBookId, info.gramCount, [&image, grams](size_t i) {
+                return make_pair(grams[i].gram, image.postings(grams[i]));
+                })) {
+                mappedCheckpoint = move(reader);
+            }
+            else {
+                cerr << "The search index of the snapshot is corrupt, indexing its books again.\n";
+                indexPlaced();
+            }
+        }
+        reserveIfSupported(patrons, patrons.size() + info.patronCount);
+        patronSlots.reserve(patronSlots.size() + info.patronCount);
+        patronIndex.reserve(patronIndex.size() + info.patronCount);
+        for (uint64_t i = 0; i < info.patronCount; i++) {
+            const snapshot::Patron& record = patronRecords[i];
+            if (!image.valid(record.firstName) || !image.valid(record.lastName)) {
+                cerr << "An error occurred while reading the snapshot: patron " << i << " is corrupt" << endl;
+                return false;
+            }
+            placePatron(string(image.str(record.firstName)), string(image.str(record.lastName)));
+        }
+        // Loans of snapshots older than due dates get the loan period from now. The patrons of the
+        // snapshot got consecutive IDs in its order
+        int64_t defaultDue = time(nullptr) + loanPeriod;
+        for (uint64_t i = 0; i < info.loanCount; i++) {
+            snapshot::Loan loan = image.loan(i);
+            if (loan.patron < info.patronCount && loan.book < info.bookCount) {
+                loans.add(firstNew + loan.book, firstPatron + loan.patron, loan.due != 0 ? loan.due : defaultDue);
+            }
+        }
+
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << "-Snapshot loaded: " << info.bookCount << " books, " << info.patronCount << " patrons, "
+            << info.loanCount << " loans in " << ms << " ms\n";
+        return true;
+    }
+
+    // Function to write a snapshot while the catalog and loans cannot change, a checkpoint names
+    // the epoch of the journal that follows it. Books are written in ID order, so the sorted
+    // views and the search index are saved by position in the same order as they are by ID.
+    // Strings are written once into a trailing blob in the same order their references are
+    // handed out
+    bool saveSnapshot(const string& fileName, uint64_t journalEpoch = 0) const {
+        StatTimer timer(stats, StatOp::WriteSnapshot);
+        vector<const Book*> ordered;
+        ordered.reserve(books.size());
+        vector<uint32_t> position(nextBookId, NoId);
+        for (BookId id = 0; id < nextBookId; id++) {
+            if (const Book* book = bookById(id)) {
+                position[id] = static_cast<uint32_t>(ordered.size());
+                ordered.push_back(book);
+            }
+        }
+        vector<snapshot::Loan> loanRecords;
+        loanRecords.reserve(loans.size());
+        uint32_t p = 0;
+        for (const Patron& patron : patrons) {
+            loans.forEachLoanOf(patron.getId(), [this, p, &position, &loanRecords](BookId book) {
+                loanRecords.push_back({ p, position[book], loans.at(loans.loanOf(book)).due });
+                });
+            p++;
+        }
+        // Posting lists may still hold removed books until the index purges them
+        auto savedId = [&position](BookId id) { return id < position.size() && position[id] != NoId; };
+        vector<snapshot::GramPostings> grams;
+        uint64_t postingCount = 0;
+        searchIndex.forEachPosting([&](uint32_t gram, span<const BookId> ids) {
+            uint32_t count = static_cast<uint32_t>(count_if(ids.begin(), ids.end(), savedId));
+            if (count > 0) {
+                grams.push_back({ gram, count, postingCount });
+                postingCount += count;
+            }
+            });
+
+        snapshot::Header header{};
+        memcpy(header.magic, snapshot::magic, sizeof(header.magic));
+        header.version = snapshot::version;
+        header.headerSize = sizeof(snapshot::Header);
+        header.journalEpoch = journalEpoch;
+        header.bookCount = ordered.size();
+        header.patronCount = patrons.size();
+        header.loanCount = loanRecords.size();
+        header.booksOffset = sizeof(snapshot::Header);
+        header.patronsOffset = header.booksOffset + header.bookCount * sizeof(snapshot::Book);
+        header.loansOffset = header.patronsOffset + header.patronCount * sizeof(snapshot::Patron);
+        header.titleOrderOffset = header.loansOffset + header.loanCount * sizeof(snapshot::Loan);
+        header.authorOrderOffset = header.titleOrderOffset + header.bookCount * sizeof(uint32_t);
+        uint64_t ordersEnd = header.authorOrderOffset + header.bookCount * sizeof(uint32_t);
+        header.gramsOffset = (ordersEnd + 7) / 8 * 8;
+        header.gramCount = grams.size();
+        header.postingsOffset = header.gramsOffset + header.gramCount * sizeof(snapshot::GramPostings);
+        header.postingCount = postingCount;
+        header.stringsOffset = header.postingsOffset + header.postingCount * sizeof(uint32_t);
+        for (const Book* book : ordered) {
+            header.stringsSize += book->title.size() + book->author.size();
+        }
+        for (const Patron& patron : patrons) {
+            header.stringsSize += patron.getFirstName().size() + patron.getLastName().size();
+        }
+
+        uint64_t nextString = 0;
+        auto ref = [&nextString](string_view str) {
+            snapshot::StringRef stringRef{ nextString, str.size() };
+            nextString += str.size();
+            return stringRef;
+        };
+        snapshot::Writer writer(fileName);
+        writer.write(header);
+        for (const Book* book : ordered) {
+            snapshot::StringRef title = ref(book->title);
+            snapshot::StringRef author = ref(book->author);
+            writer.write(snapshot::Book{ title, author, book->checkedOut ? 1u : 0u });
+        }
+        for (const Patron& patron : patrons) {
+            snapshot::StringRef first = ref(patron.getFirstName());
+            snapshot::StringRef last = ref(patron.getLastName());
+            writer.write(snapshot::Patron{ first, last });
+        }
+        writer.write(loanRecords.data(), loanRecords.size() * sizeof(snapshot::Loan));
+        vector<uint32_t> run;
+        auto writeView = [&](const auto& view) {
+            run.clear();
+            for (BookId id : view) {
+                run.push_back(position[id]);
+            }
+            writer.write(run.data(), run.size() * sizeof(uint32_t));
+        };
+        writeView(titleOrder);
+        writeView(authorOrder);
+        const char padding[8] = {};
+        writer.write(padding, header.gramsOffset - ordersEnd);
+        writer.write(grams.data(), grams.size() * sizeof(snapshot::GramPostings));
+        searchIndex.forEachPosting([&](uint32_t, span<const BookId> ids) {
+            run.clear();
+            for (BookId id : ids) {
+                if (savedId(id)) {
+                    run.push_back(position[id]);
+                }
+            }
+            writer.write(run.data(), run.size() * sizeof(uint32_t));
+            });
+        for (const Book* book : ordered) {
+            writer.write(book->title.data(), book->title.size());
+            writer.write(book->author.data(), book->author.size());
+        }
+        for (const Patron& patron : patrons) {
+            writer.write(patron.getFirstName().data(), patron.getFirstName().size());
+            writer.write(patron.getLastName().data(), patron.getLastName().size());
+        }
+        if (!writer.commit()) {
+            cerr << "Unable to write snapshot " << fileName << ".\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Function to add the books of a parsed catalog that are not in the library yet, the caller
+    // holds catalogLock exclusively and catches up the sorted views. Returns the number added
+    size_t mergeCatalog(ParsedCatalog& catalog) {
+        size_t added = 0;
+        for (ImportedBook& book : catalog.books) {
+            if (!containsBook(book.title, book.author)) {
+                placeBook(book.title, book.author, book.checkedOut);
+                added++;
+            }
+        }
+        return added;
+    }
+
+public:
+    // Function to convert string to lowercase
+    string lower(string toBeLower) {
+        for (char& c : toBeLower) {
+            c = tolower(c);
+        }
+        return toBeLower;
+    }
+    // Funciton to detect whitespace in string
+    bool hasWhitespace(const string& str) {
+        return any_of(str.begin(), str.end(), [](char c) { 
+            if (isspace(c)) {
+            cout << "Error: Whitespaces are not allowed in the name.\n";
+        }
+        return isspace(c); });
+    }
+    
+    // Function to start the audit log, until then events are not recorded
+    void openAuditLog(const string& fileName = "user_log.txt") {
+        if (!audit.open(fileName)) {
+            cerr << "Unable to open log file for writing.\n";
+        }
+    }
+
+    // Function to log user name with date, this mimics the librarian/user
+    void logUserName(const string& firstName, const string& lastName) {
+        people.push_back(Person(firstName, lastName));
+        audit.record("LOGIN", { firstName, lastName });
+    }
+
+    ~Library() {
+        stopOverdueNotices();
+    }
+
+    // Function to start the background thread that notes overdue loans, once right away and
+    // then every overdueInterval
+    void startOverdueNotices() {
+        if (overdueTicker.joinable()) {
+            return;
+        }
+        tickerStopping = false;
+        overdueTicker = thread([this] {
+            unique_lock<mutex> lock(tickerMutex);
+            while (!tickerStopping) {
+                lock.unlock();
+                {
+                    shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+                    lock_guard<mutex> loanGuard(loanMutex);
+                    noteOverdueLoans();
+                }
+                lock.lock();
+                tickerWake.wait_for(lock, overdueInterval, [this] { return tickerStopping; });
+            }
+            });
+    }
+
+    // Function to stop the overdue thread and wait for it
+    void stopOverdueNotices() {
+        if (!overdueTicker.joinable()) {
+            return;
+        }
+        {
+            lock_guard<mutex> lock(tickerMutex);
+            tickerStopping = true;
+        }
+        tickerWake.notify_all();
+        overdueTicker.join();
+    }
+
+    // Function to call onLoan(book, patron, due) for every loan overdue as of now, in the order
+    // they fell due. Costs O(overdue loans), the loans that are not overdue are not visited
+    template<typename OnLoan>
+    void forEachOverdueLoan(OnLoan onLoan) {
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        lock_guard<mutex> loanGuard(loanMutex);
+        noteOverdueLoans();
+        loans.forEachOverdue([this, &onLoan](const LoanTable::Loan& loan) {
+            const Book* book = bookById(loan.book);
+            const Patron* patron = patronById(loan.patron);
+            if (book && patron) {
+                onLoan(*book, *patron, loan.due);
+            }
+            });
+    }
+
+    // Function to print every overdue book with its patron and due date
+    void printOverdueBooks() {
+        const int64_t day = 24 * 60 * 60;
+        int64_t now = time(nullptr);
+        bool any = false;
+        forEachOverdueLoan([now, &any](const Book& book, const Patron& patron, int64_t due) {
+            if (!any) {
+                cout << "\nOverdue books:\n";
+                any = true;
+            }
+            cout << "- " << book.title << " by " << book.author << ", checked out by " << patron.getFirstName() << " "
+                << patron.getLastName() << ", due " << formatDate(due) << " (" << (now - due) / day << " days overdue)\n";
+            });
+        if (!any) {
+            cout << "\nNo books are overdue.\n";
+        }
+    }
+
+    // Function to search books by author
+    void searchBooksByAuthor() {
+        string authorFirstName, authorLastName;
+        cout << "Enter author first name: ";
+        getline(cin, authorFirstName);
+        if (hasWhitespace(authorFirstName)) { return; }
+        cout << "Enter author last name: ";
+        getline(cin, authorLastName);
+        if (hasWhitespace(authorLastName)) { return; }
+
+        cout << "\nRESULTS:\nBooks by author " << authorFirstName << " " << authorLastName << ":\n";
+        StatTimer timer(stats, StatOp::SearchAuthor);
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        auto it = authorIndex.find(authorFirstName + " " + authorLastName);
+        if (it == authorIndex.end()) {
+            return;
+        }
+        for (BookId id : it->second) {
+            const Book& book = *bookById(id);
+            cout << "- " << book.title << " (";
+            if (book.isCheckedOut()) {
+                cout << "Checked out)\n";
+            }
+            else {
+                cout << "Available)\n";
+            }
+        }
+    }
+
+    // Function to search for a book by title
+    void searchBookByTitle() {
+        string title;
+        cout << "Enter book title: ";
+        getline(cin, title);
+
+        StatTimer timer(stats, StatOp::SearchTitle);
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        const Book* book = findBookByTitle(title);
+        if (book) {
+            cout << "\nRESULTS:\n-Book: " << book->title << " by " << book->author << " (";
+            if (book->isCheckedOut()) {
+                cout << "Checked out)\n";
+            }
+            else {
+                cout << "Available)\n";
+            }
+            return;
+        }
+        cout << "Book not found.\n";
+    }
+    
+    // Function to look up a book by title ignoring case without prompting, nullptr if not found.
+    // The pointer is only good until the catalog next changes, concurrent callers use withTitle
+    const Book* lookupTitle(const string& title) {
+        StatTimer timer(stats, StatOp::SearchTitle);
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        return findBookByTitle(title);
+    }
+
+    // Function to call onBook(book) for the book with this title ignoring case, while the
+    // catalog cannot change. Returns false if there is no such book
+    template<typename OnBook>
+    bool withTitle(const string& title, OnBook onBook) const {
+        StatTimer timer(stats, StatOp::SearchTitle);
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        auto it = titleIndex.find(title);
+        if (it == titleIndex.end()) {
+            return false;
+        }
+        onBook(*bookById(it->second.first));
+        return true;
+    }
+
+    // Function to call onBook(book) for every book by an author, ignoring case
+    template<typename OnBook>
+    void forEachBookByAuthor(const string& author, OnBook onBook) {
+        StatTimer timer(stats, StatOp::SearchAuthor);
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        auto it = authorIndex.find(author);
+        if (it != authorIndex.end()) {
+            for (BookId id : it->second) {
+                onBook(*static_cast<const Book*>(bookById(id)));
+            }
+        }
+    }
+
+    // Function to rank the k best books for a partial title or author. Short queries may have one
+    // typo, queries of eight or more characters two
+    vector<SearchHit> searchCatalog(const string& query, size_t k = 10) {
+        StatTimer timer(stats, StatOp::SearchPartial);
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        return rankCatalog(query, k);
+    }
+
+    // Function to call onHit(book, hit) for the k best books for a query, best first, while the
+    // catalog cannot change
+    template<typename OnHit>
+    void searchCatalog(const string& query, size_t k, OnHit onHit) {
+        StatTimer timer(stats, StatOp::SearchPartial);
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        for (const SearchHit& hit : rankCatalog(query, k)) {
+            if (const Book* book = bookById(hit.id)) {
+                onHit(*book, hit);
+            }
+        }
+    }
+
+    size_t bookCount() const {
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        return books.size();
+    }
+    size_t patronCount() const {
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        return patrons.size();
+    }
+    size_t loanCount() const {
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        lock_guard<mutex> loanGuard(loanMutex);
+        return loans.size();
+    }
+
+    // Function to count the books on the shelf, a popcount over the bitmaps
+    size_t availableCount() const {
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        lock_guard<mutex> loanGuard(loanMutex);
+        return liveBooks.countAndNot(checkedOutBooks);
+    }
+
+    // Function to count the books checked out, including those flagged in the catalog file
+    size_t checkedOutCount() const {
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        lock_guard<mutex> loanGuard(loanMutex);
+        return checkedOutBooks.count();
+    }
+
+    // Function to call onBook(book) for every available book, in the order they were added
+    template<typename OnBook>
+    void forEachAvailableBook(OnBook onBook) const {
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        vector<BookId> available;
+        {
+            lock_guard<mutex> loanGuard(loanMutex);
+            available.reserve(liveBooks.countAndNot(checkedOutBooks));
+            liveBooks.forEachAndNot(checkedOutBooks, [&available](BookId id) { available.push_back(id); });
+        }
+        for (BookId id : available) {
+            onBook(*bookById(id));
+        }
+    }
+
+    // Function to call onBook(book) for every available book by an author, ignoring case
+    template<typename OnBook>
+    void forEachAvailableBookByAuthor(const string& author, OnBook onBook) const {
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        auto it = authorIndex.find(author);
+        if (it != authorIndex.end()) {
+            forEachAvailable(it->second, onBook);
+        }
+    }
+
+    // Function to call onBook(book) for every available book whose title starts with prefix,
+    // matching case, in title order
+    template<typename OnBook>
+    void forEachAvailableTitle(const string& prefix, OnBook onBook) const {
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        vector<BookId> ids;
+        titleOrder.forEachWithPrefix(prefix, [&ids](BookId id) { ids.push_back(id); });
+        forEachAvailable(ids, onBook);
+    }
+
+    // Function to add a book without prompting
+    OpStatus insertBook(const string& title, const string& author, bool checkedOut = false) {
+        StatTimer timer(stats, StatOp::AddBook);
+        if (!acceptingChanges()) {
+            return OpStatus::JournalFailing;
+        }
+        unique_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        placeBook(title, author, checkedOut);
+        logMutation(JournalOp::AddBook, { title, author, checkedOut ? "1" : "0" });
+        return OpStatus::Ok;
+    }
+
+    // Function to remove the book with exactly this title and author without prompting
+    OpStatus eraseBook(const string& title, const string& author) {
+        StatTimer timer(stats, StatOp::RemoveBook);
+        if (!acceptingChanges()) {
+            return OpStatus::JournalFailing;
+        }
+        unique_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        // The author index narrows the search, the match itself stays case sensitive
+        auto authorIt = authorIndex.find(author);
+        if (authorIt == authorIndex.end()) {
+            return OpStatus::BookNotFound;
+        }
+        for (BookId id : authorIt->second) {
+            const Book& book = *bookById(id);
+            if (book.title == title && book.author == author) {
+                uint32_t loan = loans.loanOf(id);
+                if (loan != NoId) {
+                    loans.remove(loan);
+                }
+                titleOrder.erase(id);
+                authorOrder.erase(id);
+                searchIndex.remove(id, book.title, book.author);
+                liveBooks.assign(id, false);
+                checkedOutBooks.assign(id, false);
+                unindexBook(book);
+                books.erase(bookSlots[id]);
+                bookSlots[id] = SlotHandle();
+                logMutation(JournalOp::RemoveBook, { title, author });
+                return OpStatus::Ok;
+            }
+        }
+        return OpStatus::BookNotFound;
+    }
+
+    // Function to check out a book to a patron without prompting, due at a Unix time or after the
+    // loan period when due is 0. Safe to call from several desks at once: exactly one of two
+    // checkouts racing for a copy succeeds. On success bookTitle, if given, gets the title as
+    // the catalog spells it, read while the book cannot go away
+    OpStatus checkOut(const string& firstName, const string& lastName, const string& title, int64_t due = 0, string* bookTitle = nullptr) {
+        StatTimer timer(stats, StatOp::CheckOut);
+        if (!acceptingChanges()) {
+            return OpStatus::JournalFailing;
+        }
+        ShardedSharedMutex::UpdateLock catalogGuard(catalogLock);
+        Patron* patron = findPatron(firstName, lastName);
+        if (!patron) {
+            return OpStatus::PatronNotFound;
+        }
+        Book* book = findBookByTitle(title);
+        if (!book) {
+            return OpStatus::BookNotFound;
+        }
+        lock_guard<mutex> loanGuard(loanMutex);
+        OpStatus status = lendBook(*book, *patron, firstName, lastName, title, due);
+        if (status == OpStatus::Ok && bookTitle) {
+            *bookTitle = book->title;
+        }
+        return status;
+    }
+
+    // Function to return a patron's book without prompting, bookTitle as for checkOut
+    OpStatus checkIn(const string& firstName, const string& lastName, const string& title, string* bookTitle = nullptr) {
+        StatTimer timer(stats, StatOp::Return);
+        if (!acceptingChanges()) {
+            return OpStatus::JournalFailing;
+        }
+        ShardedSharedMutex::UpdateLock catalogGuard(catalogLock);
+        Patron* patron = findPatron(firstName, lastName);
+        if (!patron) {
+            return OpStatus::PatronNotFound;
+        }
+        Book* book = findBookByTitle(title);
+        if (!book) {
+            return OpStatus::BookNotFound;
+        }
+        lock_guard<mutex> loanGuard(loanMutex);
+        OpStatus status = returnBook(*book, *patron, firstName, lastName, title);
+        if (status == OpStatus::Ok && bookTitle) {
+            *bookTitle = book->title;
+        }
+        return status;
+    }
+
+    // Function to apply a batch of checkouts and returns as one step, returning the status of
+    // each request in order. Every patron and title is resolved first by a probe of the hash
+    // indexes under one hold of the catalog lock, then the loans are applied in request order
+    // under one hold of loanMutex. No desk sees part of a batch, and a return in a batch sees
+    // a checkout earlier in the same batch
+    vector<OpStatus> applyCirculation(span<const CirculationRequest> requests) {
+        StatTimer timer(stats, StatOp::BulkCirculation);
+        if (!acceptingChanges()) {
+            return vector<OpStatus>(requests.size(), OpStatus::JournalFailing);
+        }
+        vector<OpStatus> statuses(requests.size(), OpStatus::Ok);
+        vector<pair<Book*, Patron*>> resolved(requests.size());
+        ShardedSharedMutex::UpdateLock catalogGuard(catalogLock);
+        for (size_t i = 0; i < requests.size(); i++) {
+            const CirculationRequest& request = requests[i];
+            resolved[i] = { findBookByTitle(request.title), findPatron(request.firstName, request.lastName) };
+        }
+        lock_guard<mutex> loanGuard(loanMutex);
+        for (size_t i = 0; i < requests.size(); i++) {
+            const CirculationRequest& request = requests[i];
+            auto [book, patron] = resolved[i];
+            if (!patron) {
+                statuses[i] = OpStatus::PatronNotFound;
+            }
+            else if (!book) {
+                statuses[i] = OpStatus::BookNotFound;
+            }
+            else if (request.action == CirculationEvent::CheckOut) {
+                statuses[i] = lendBook(*book, *patron, request.firstName, request.lastName, request.title, request.due);
+            }
+            else {
+                statuses[i] = returnBook(*book, *patron, request.firstName, request.lastName, request.title);
+            }
+        }
+        return statuses;
+    }
+
+    // Function to add a patron without prompting
+    OpStatus insertPatron(const string& firstName, const string& lastName) {
+        if (!acceptingChanges()) {
+            return OpStatus::JournalFailing;
+        }
+        unique_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        placePatron(firstName, lastName);
+        logMutation(JournalOp::AddPatron, { firstName, lastName });
+        return OpStatus::Ok;
+    }
+
+    // Function to remove the patron with exactly this name without prompting. The registry
+    // narrows the search, the match itself stays case sensitive
+    OpStatus erasePatron(const string& firstName, const string& lastName) {
+        if (!acceptingChanges()) {
+            return OpStatus::JournalFailing;
+        }
+        unique_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        auto range = patronIndex.equal_range(PatronName{ firstName, lastName });
+        auto match = patronIndex.end();
+        for (auto it = range.first; it != range.second; ++it) {
+            const Patron& patron = *patronById(it->second);
+            if (patron.getFirstName() == firstName && patron.getLastName() == lastName && (match == patronIndex.end() || it->second < match->second)) {
+                match = it;
+            }
+        }
+        if (match == patronIndex.end()) {
+            return OpStatus::PatronNotFound;
+        }
+        PatronId id = match->second;
+        // The patron's books go back on the shelf
+        loans.releasePatron(id, [this](BookId book) {
+            if (Book* loaned = bookById(book)) {
+                markCheckedOut(*loaned, false);
+            }
+            });
+        patrons.erase(patronSlots[id]);
+        patronSlots[id] = SlotHandle();
+        patronIndex.erase(match);
+        logMutation(JournalOp::RemovePatron, { firstName, lastName });
+        return OpStatus::Ok;
+    }
+
+    // Function to search books by partial title or author, best matches first
+    void findBooks() {
+        string query;
+        cout << "Enter part of a title or author: ";
+        getline(cin, query);
+
+        bool found = false;
+        searchCatalog(query, 10, [&found](const Book& book, const SearchHit& hit) {
+            if (!found) {
+                cout << "\nRESULTS:\n";
+                found = true;
+            }
+            cout << "- " << book.title << " by " << book.author << " (" << (book.isCheckedOut() ? "Checked out" : "Available") << ")";
+            if (hit.kind == MatchKind::Fuzzy) {
+                cout << " [close match]";
+            }
+            cout << "\n";
+            });
+        if (!found) {
+            cout << (query.size() < 2 ? "Please enter at least two characters.\n" : "No matching books found.\n");
+        }
+    }
+
+    // Function to add a book
+    void addBook() {
+        string title, authorFirstName, authorLastName;
+        cout << "Enter the title of the book: ";
+        getline(cin, title);
+        cout << "Enter the first name of the author of the book: ";
+        getline(cin, authorFirstName);
+        if (hasWhitespace(authorFirstName)) { return; };
+
+        cout << "Enter the last name of the author of the book: ";
+        getline(cin, authorLastName);
+        if (hasWhitespace(authorLastName)) { return; }
+
+        string author = authorFirstName + " " + authorLastName;
+        if (insertBook(title, author) == OpStatus::JournalFailing) {
+            cout << "Book not added, changes cannot be saved right now.\n";
+            return;
+        }
+        // The book is shown as it was added, another desk may have changed the catalog since
+        cout << Book(title, author, {}, {}, false) << "\nBook added to the library.\n";
+    }
+
+    // Function to remove a book
+    void removeBook() {
+        string title, authorFirstName, authorLastName;
+        cout << "*Case sensitive for safety\n";
+        cout << "Enter the title of the book to remove: ";
+        getline(cin, title);
+        cout << "Enter the first name of the author of the book to remove: ";
+        getline(cin, authorFirstName);
+        if (hasWhitespace(authorFirstName)) { return; };
+
+        cout << "Enter the last name of the author of the book to remove: ";
+        getline(cin, authorLastName);
+        if (hasWhitespace(authorLastName)) { return; };
+
+        cout << "\nTitle: " << title << ", Author: " << authorFirstName << " " << authorLastName << endl;
+
+        OpStatus status = eraseBook(title, authorFirstName + " " + authorLastName);
+        if (status == OpStatus::Ok) {
+            cout << "Has been successfully removed from the library.\n";
+        }
+        else if (status == OpStatus::JournalFailing) {
+            cout << "Not removed, changes cannot be saved right now.\n";
+        }
+        else {
+            cout << "Book not found in the library.\n";
+        }
+
+    }
+
+    // Function to check out a book
+    void checkOutBook() {
+        string patronFirstName, patronLastName, bookTitle;
+        cout << "Enter patron first name: ";
+        cin >> patronFirstName;
+        cout << "Enter patron last name: ";
+        cin >> patronLastName;
+        cout << "Enter book title to check out: ";
+        cin.ignore();
+        getline(cin, bookTitle);
+
+        string shelvedTitle;
+        switch (checkOut(patronFirstName, patronLastName, bookTitle, 0, &shelvedTitle)) {
+        case OpStatus::Ok:
+            cout << shelvedTitle << " has been checked out by " << patronFirstName << " " << patronLastName << endl;
+            break;
+        case OpStatus::AlreadyCheckedOut:
+            cout << "Book is already checked out.\n";
+            break;
+        case OpStatus::BookNotFound:
+            cout << "Book not found.\n";
+            break;
+        case OpStatus::JournalFailing:
+            cout << "Changes cannot be saved right now, try again later.\n";
+            break;
+        default:
+            cout << "Patron not found.\n";
+            break;
+        }
+    }
+
+    // Function to return a book
+    void returnBook() {
+        string patronFirstName, patronLastName, bookTitle;
+        cout << "Enter patron first name: ";
+        cin >> patronFirstName;
+        cout << "Enter patron last name: ";
+        cin >> patronLastName;
+        cout << "Enter book title to return: ";
+        cin.ignore();
+        getline(cin, bookTitle);
+
+        string shelvedTitle;
+        switch (checkIn(patronFirstName, patronLastName, bookTitle, &shelvedTitle)) {
+        case OpStatus::Ok:
+            cout << shelvedTitle << " has been returned by " << patronFirstName << " " << patronLastName << endl;
+            break;
+        case OpStatus::NotCheckedOut:
+            cout << "Book is not checked out.\n";
+            break;
+        case OpStatus::HeldByOtherPatron:
+            cout << "Book is checked out by another patron.\n";
+            break;
+        case OpStatus::BookNotFound:
+            cout << "Book not found.\n";
+            break;
+        case OpStatus::JournalFailing:
+            cout << "Changes cannot be saved right now, try again later.\n";
+            break;
+        default:
+            cout << "Patron not found.\n";
+            break;
+        }
+    }
+
+    // Function to list books by title, the title view is always in order
+    void sortBooksByTitle() {
+        listOrder = BookOrder::Title;
+    }
+
+    // Function to list books by author, the author view is always in order
+    void sortBooksByAuthor() {
+        listOrder = BookOrder::Author;
+    }
+
+    // Function to prompt user to sort books by title or author
+    void promptSortBy() {
+        char choice;
+        cout << "Sort by (T)itle or (A)uthor? ";
+        cin >> choice;
+        switch (toupper(choice)) {
+        case 'T':
+            sortBooksByTitle();
+            break;
+        case 'A':
+            sortBooksByAuthor();
+            break;
+        default:
+            cout << "Invalid choice. Sorting by title by default.\n";
+            sortBooksByTitle();
+            break;
+        }
+    }
+
+    // Function to call onBook(book) for every book in the given order, without sorting
+    template<typename OnBook>
+    void forEachBookInOrder(BookOrder order, OnBook onBook) const {
+        StatTimer timer(stats, StatOp::SortedList);
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        switch (order) {
+        case BookOrder::Title:
+            for (BookId id : titleOrder) {
+                onBook(*bookById(id));
+            }
+            break;
+        case BookOrder::Author:
+            for (BookId id : authorOrder) {
+                onBook(*bookById(id));
+            }
+            break;
+        default:
+            for (const Book& book : books) {
+                onBook(book);
+            }
+            break;
+        }
+    }
+
+    // Function to print all books in the order last chosen with promptSortBy
+    void printAllBooks() {
+        cout << "\nList of Books:\n";
+        forEachBookInOrder(listOrder, [](const Book& book) {
+            cout << "- " << book.title << " by " << book.author << "\n";
+            });
+        cout.flush();
+    } 
+
+    // Function to list the available books, all of them or those of an author or a title prefix
+    void printAvailableBooks() {
+        string choice, key;
+        cout << "Enter A to list by author, T to list by the start of the title, or press Enter to list all: ";
+        getline(cin, choice);
+        size_t shown = 0;
+        auto print = [&shown](const Book& book) {
+            cout << "- " << book.title << " by " << book.author << "\n";
+            shown++;
+        };
+        if (choice == "A" || choice == "a") {
+            cout << "Enter author name: ";
+            getline(cin, key);
+            cout << "\nAvailable books by " << key << ":\n";
+            forEachAvailableBookByAuthor(key, print);
+        }
+        else if (choice == "T" || choice == "t") {
+            cout << "Enter the start of the title: ";
+            getline(cin, key);
+            cout << "\nAvailable books starting with " << key << ":\n";
+            forEachAvailableTitle(key, print);
+        }
+        else {
+            cout << "\nAvailable books:\n";
+            forEachAvailableBook(print);
+        }
+        cout << shown << " shown, " << checkedOutCount() << " of " << bookCount() << " books are checked out.\n";
+    }
+
+    // Function to add a patron
+    void addPatron() {
+        string firstName, lastName;
+        cout << "Enter first name of the patron to add: ";
+        getline(cin, firstName);
+        if (hasWhitespace(firstName)) {
+            return; 
+        }
+        cout << "Enter last name of the patron to add: ";
+        getline(cin, lastName);
+        if (hasWhitespace(lastName)) {
+            return; // Abort adding patron
+        }
+        if (insertPatron(firstName, lastName) == OpStatus::JournalFailing) {
+            cout << "\nPatron not added, changes cannot be saved right now.\n";
+            return;
+        }
+        cout << "\nPatron added: " << firstName << " " << lastName << "\n";
+    }
+
+    // Function to remove a patron
+    void removePatron() {
+        string firstName, lastName;
+        cout << "Enter first name of the patron to remove: ";
+        getline(cin, firstName);
+        if (hasWhitespace(firstName)) {
+            return;
+        }
+        cout << "Enter last name of the patron to remove: ";
+        getline(cin, lastName);
+        if (hasWhitespace(lastName)) {
+            return;
+        }
+
+        OpStatus status = erasePatron(firstName, lastName);
+        if (status == OpStatus::Ok) {
+            cout << "\nPatron removed: " << firstName << " " << lastName << "\n";
+        }
+        else if (status == OpStatus::JournalFailing) {
+            cout << "\nPatron not removed, changes cannot be saved right now.\n";
+        }else {
+            cout << "\nPatron not found.\n";
+        }
+    }
+
+    // Function to display books checked out by a patron
+    void displayBooksCheckedOutByPatron() {
+        string firstName, lastName;
+        cout << "Enter patron first name: ";
+        cin >> firstName;
+        cout << "Enter patron last name: ";
+        cin >> lastName;
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        const Patron* patron = findPatron(firstName, lastName);
+        if (!patron) {
+            cout << "\nPatron not found.\n";
+            return;
+        }
+        lock_guard<mutex> loanGuard(loanMutex);
+        bool hasLoans = false;
+        loans.forEachLoanOf(patron->getId(), [this, &hasLoans, &firstName, &lastName](BookId id) {
+            if (!hasLoans) {
+                cout << "\nBooks checked out by " << firstName << " " << lastName << ":\n";
+                hasLoans = true;
+            }
+            const Book* book = bookById(id);
+            const LoanTable::Loan& loan = loans.at(loans.loanOf(id));
+            cout << "- " << book->title << " by " << book->author << ", due " << formatDate(loan.due) << "\n";
+            });
+        if (!hasLoans) {
+            cout << "\nNo books checked out by " << firstName << " " << lastName << "\n";
+        }
+    }
+
+    // Function to print all patrons
+    void printAllPatrons() {
+        cout << "\nList of Patrons:\n";
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        for (const Patron& patron : patrons) {
+            cout << "- " << patron.getFirstName() << " " << patron.getLastName() << "\n";
+        }
+    }
+
+    // Function to write books to a JSON file
+    void writeToLogFile(const string& fileName = "booksLogTo.json") {
+        jsonexport::Report report;
+        if (!exportBooks(fileName, jsonexport::Options(), report)) {
+            cerr << "Unable to open file for writing.\n";
+            return;
+        }
+        cout << "\nBooks written to file.\n";
+        printExportReport(report, cout);
+        cout << "\n";
+    }
+
+    // Function to write the books that pass the filter to a JSON file, compact or pretty. The
+    // books are collected under the locks, which is a copy of three fields each, and encoded and
+    // written after they are released; the pool the strings are in is held meanwhile
+    bool exportBooks(const string& fileName, const jsonexport::Options& options, jsonexport::Report& report) const {
+        StatTimer timer(stats, StatOp::WriteFile);
+        vector<jsonexport::Record> records;
+        shared_ptr<const StringPool> pinned;
+        {
+            shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+            lock_guard<mutex> loanGuard(loanMutex);
+            pinned = strings;
+            records.reserve(options.filter == jsonexport::Filter::All ? books.size() : 0);
+            for (const Book& book : books) {
+                if (options.filter == jsonexport::Filter::All || book.checkedOut == (options.filter == jsonexport::Filter::CheckedOut)) {
+                    records.push_back({ book.title, book.author, book.checkedOut });
+                }
+            }
+        }
+        return jsonexport::writeBooks(records, fileName, options, report);
+    }
+
+    // Function to read books from a JSON file. The file is memory mapped and parsed in one
+    // SAX pass, books already in the library (same title and author) are skipped
+    bool readFromFile(const string& fileName = "books.json") {
+        StatTimer timer(stats, StatOp::ReadFile);
+        auto start = chrono::steady_clock::now();
+        MappedFile file;
+        if (!file.open(fileName)) {
+            cerr << "An error occurred while reading from file: unable to open " << fileName << endl;
+            return false;
+        }
+        if (!acceptingChanges()) {
+            cerr << "An error occurred while reading from file: " << statusMessage(OpStatus::JournalFailing) << endl;
+            return false;
+        }
+
+        unique_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        size_t records = 0, added = 0;
+        BookId firstNew = nextBookId;
+        deferViews = true;
+        loadFileBytes = file.size();
+        loadedBytes = 0;
+        // Every loadChunk records the load steps aside for searches that are waiting, which see
+        // the books read so far, for at most loadStepAside. Checkouts, returns and other changes
+        // wait for the whole load. The sorted views catch up once at the end
+        const size_t loadChunk = 4096;
+        auto onBook = [this, &records, &added](string& title, string& author, bool checkedOut) {
+            if (++records % loadChunk == 0) {
+                loadedRecords.store(records, memory_order_relaxed);
+                if (catalogLock.readersWaiting()) {
+                    catalogLock.stepAside(loadStepAside);
+                }
+            }
+            if (containsBook(title, author)) {
+                return;
+            }
+            placeBook(title, author, checkedOut);
+            added++;
+        };
+        BookSaxHandler<decltype(onBook)> handler(onBook);
+        ProgressIterator::Progress progress{ file.begin(), loadedBytes };
+        bool parsed = json::sax_parse(ProgressIterator{ file.begin(), &progress }, ProgressIterator{ file.end(), &progress }, &handler);
+        loadedRecords = records;
+        loadedBytes = file.size();
+        catchUpViews(firstNew);
+        // Books read before a parse error stay, as they always have, so they are made durable too
+        if (added > 0) {
+            persistBulkAdd(firstNew);
+        }
+        if (!parsed) {
+            cerr << "An error occurred while reading from file: " << handler.errorMessage << endl;
+            return false;
+        }
+
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "\n-Books read from file.\n";
+        cout << "-" << records << " records, " << added << " added, " << records - added << " duplicates skipped ("
+            << static_cast<uint64_t>(seconds > 0 ? records / seconds : 0) << " records/sec)\n\n";
+        return true;
+    }
+
+    // Function to import catalog files and directories of *.json files. The files are parsed and
+    // normalized on a thread pool without any lock, then merged in the order given under one
+    // exclusive catalogLock, so the order of the paths decides which copy of a book wins and the
+    // sorted views are caught up once for the whole import. A file that fails to parse is
+    // reported and left out whole. Books already in the library are skipped
+    vector<ImportFileReport> importCatalogs(const vector<string>& paths, size_t threads = 0) {
+        StatTimer timer(stats, StatOp::Import);
+        vector<string> files = expandCatalogPaths(paths);
+        vector<ImportFileReport> reports;
+        if (files.empty()) {
+            return reports;
+        }
+        if (!acceptingChanges()) {
+            for (const string& file : files) {
+                reports.push_back({ file, 0, 0, statusMessage(OpStatus::JournalFailing) });
+            }
+            return reports;
+        }
+        vector<ParsedCatalog> catalogs;
+        catalogs.reserve(files.size());
+        {
+            ThreadPool pool(min<size_t>(threads ? threads : max(1u, thread::hardware_concurrency()), files.size()));
+            vector<future<ParsedCatalog>> parsed;
+            parsed.reserve(files.size());
+            for (const string& file : files) {
+                parsed.push_back(pool.submit([file] { return parseCatalogFile(file); }));
+            }
+            for (future<ParsedCatalog>& job : parsed) {
+                catalogs.push_back(job.get());
+            }
+        }
+
+        unique_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        BookId firstNew = nextBookId;
+        size_t added = 0;
+        deferViews = true;
+        for (ParsedCatalog& catalog : catalogs) {
+            ImportFileReport report;
+            report.fileName = catalog.fileName;
+            report.records = catalog.records;
+            report.error = catalog.error;
+            if (report.error.empty()) {
+                report.added = mergeCatalog(catalog);
+                added += report.added;
+            }
+            reports.push_back(move(report));
+        }
+        catchUpViews(firstNew);
+        if (added > 0) {
+            persistBulkAdd(firstNew);
+        }
+        return reports;
+    }
+
+    // Function to prompt for catalog files or directories and import them
+    void importBooks() {
+        string line, path;
+        cout << "Enter JSON files or directories to import, separated by spaces: ";
+        getline(cin, line);
+        vector<string> paths;
+        istringstream words(line);
+        while (words >> path) {
+            paths.push_back(path);
+        }
+        auto start = chrono::steady_clock::now();
+        vector<ImportFileReport> reports = importCatalogs(paths);
+        if (reports.empty()) {
+            cout << "No catalog files found.\n";
+            return;
+        }
+        cout << "\n";
+        printImportReports(reports, chrono::duration<double>(chrono::steady_clock::now() - start).count(), cout);
+        cout << "\n";
+    }
+
+    // Function to rebuild the library from the last checkpoint plus the journal. Returns
+    // false when there is nothing to recover, which means this is a fresh start. Runs before
+    // the library is shared with other threads
+    bool recoverFromJournal() {
+        bool recovered = false;
+        uint64_t checkpointEpoch = 0;
+        replaying = true;
+        if (filesystem::exists(checkpointFile)) {
+            recovered = loadSnapshot(checkpointFile, checkpointEpoch);
+        }
+        // A journal older than the checkpoint is one a crash kept from being reset after the
+        // checkpoint was written, everything in it is in the checkpoint already
+        bool folded = recovered && Journal::epochOf(journalFile) < checkpointEpoch;
+        size_t records = 0;
+        if (!folded) {
+            records = Journal::replay(journalFile, [this](uint8_t op, int64_t, const vector<string_view>& fields) {
+                applyJournalRecord(op, fields);
+                });
+        }
+        replaying = false;
+        skipNoticed = noticedThrough != 0;
+        if (!journal.open(journalFile) || (folded && !journal.reset(checkpointEpoch))) {
+            cerr << "Unable to open journal for writing, changes will not be persisted.\n";
+        }
+        if (!history.open(historyFile)) {
+            cerr << "Unable to open " << historyFile << ", circulation history will not be saved.\n";
+        }
+        if (records > 0) {
+            cout << "-Recovered " << records << " journal records.\n";
+        }
+        return recovered || records > 0;
+    }
+
+    // Function to make the staged journal records durable. Called once per command so all
+    // of a command's mutations are committed as one group
+    void commitJournal() {
+        bool compact;
+        {
+            lock_guard<mutex> journalGuard(journalMutex);
+            bool committed = journal.commit();
+            if (!committed) {
+                cerr << "Unable to write to journal, changes are refused until it can be written.\n";
+            }
+            else if (journalFailing) {
+                cerr << "Journal written again, changes are accepted.\n";
+            }
+            journalFailing = !committed;
+            compact = committed && journal.size() >= compactionBytes;
+        }
+        if (!history.flush()) {
+            cerr << "Unable to write circulation history.\n";
+        }
+        if (compact) {
+            compactJournal();
+        }
+    }
+
+    // Function to fold the journal into a snapshot checkpoint and start an empty journal
+    void compactJournal() {
+        unique_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        checkpoint();
+    }
+
+    // Function to write books, patrons and loans to a binary snapshot
+    bool writeSnapshot(const string& fileName) {
+        shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+        lock_guard<mutex> loanGuard(loanMutex);
+        return saveSnapshot(fileName);
+    }
+
+    // Function to write the most borrowed titles and authors and the busiest patrons of the last
+    // days (0 for the whole history), then the checkouts and returns of each of those days (UTC)
+    void writeCirculationReport(int64_t days, ostream& out, size_t k = 10) const {
+        const int64_t day = 24 * 60 * 60;
+        int64_t tomorrow = (time(nullptr) / day + 1) * day;
+        int64_t from = days > 0 ? tomorrow - days * day : 0;
+        auto section = [&out](const char* heading, const vector<CirculationLog::Ranked>& ranked) {
+            out << heading << ":\n";
+            if (ranked.empty()) {
+                out << "- none\n";
+            }
+            for (const CirculationLog::Ranked& entry : ranked) {
+                out << "- " << entry.name << ": " << entry.count << "\n";
+            }
+        };
+        section("Most borrowed titles", history.topTitles(k, from, tomorrow));
+        section("Most borrowed authors", history.topAuthors(k, from, tomorrow));
+        section("Busiest patrons", history.topPatrons(k, from, tomorrow));
+        if (days == 0) {
+            return;
+        }
+        out << "Checkouts and returns per day:\n";
+        vector<array<uint64_t, 2>> buckets = history.activity(from, tomorrow, day);
+        for (size_t i = 0; i < buckets.size(); i++) {
+            out << "- " << formatDate(from + static_cast<int64_t>(i) * day) << ": " << buckets[i][0] << " checkouts, " << buckets[i][1] << " returns\n";
+        }
+    }
+
+    // Function to prompt for a number of days and print the circulation report
+    void printCirculationReport() {
+        int64_t days;
+        cout << "Enter the number of days to report on (0 for the whole history): ";
+        if (!(cin >> days) || days < 0) {
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid number of days.\n";
+            return;
+        }
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "\n";
+        writeCirculationReport(days, cout);
+        cout << "\n";
+    }
+
+    // Function to count a command of the interactive menu
+    void countCommand(char command) {
+        stats.countCommand(command);
+    }
+
+    // Function to gather catalog gauges and operation latencies as JSON
+    json statsReport() const {
+        json report;
+        {
+            shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+            report["books"] = books.size();
+            report["patrons"] = patrons.size();
+            report["indexBytes"] = indexMemoryBytes();
+            report["stringPoolBytes"] = strings->memoryBytes();
+            report["pooledStrings"] = strings->size();
+            lock_guard<mutex> loanGuard(loanMutex);
+            report["available"] = liveBooks.countAndNot(checkedOutBooks);
+            report["checkedOut"] = checkedOutBooks.count();
+            report["loans"] = loans.size();
+            report["overdueLoans"] = loans.overdueCount();
+        }
+        report["auditEventsDropped"] = audit.dropped();
+        uint64_t searches = searchCache.hits() + searchCache.misses();
+        report["searchCache"] = {
+            {"entries", searchCache.size()},
+            {"capacity", searchCache.capacity()},
+            {"hits", searchCache.hits()},
+            {"misses", searchCache.misses()},
+            {"stale", searchCache.stale()},
+            {"hitRate", searches ? static_cast<double>(searchCache.hits()) / searches : 0.0}
+        };
+        report["historyEvents"] = history.size();
+        report["startup"] = {
+            {"stage", loadStatus()},
+            {"loadMs", loadMicros.load() / 1000.0},
+            {"firstPromptMs", firstPromptMicros.load() / 1000.0}
+        };
+#ifndef BERRY_NO_STATS
+        json operations = json::object();
+        for (size_t i = 0; i < static_cast<size_t>(StatOp::Count); i++) {
+            const LatencyHistogram& latency = stats.op(static_cast<StatOp>(i));
+            operations[statOpName(static_cast<StatOp>(i))] = {
+                {"count", latency.count()},
+                {"meanNs", static_cast<uint64_t>(latency.mean())},
+                {"p50Ns", latency.percentile(0.50)},
+                {"p90Ns", latency.percentile(0.90)},
+                {"p99Ns", latency.percentile(0.99)},
+                {"p999Ns", latency.percentile(0.999)},
+                {"maxNs", latency.max()}
+            };
+        }
+        report["operations"] = operations;
+        json commands = json::object();
+        for (char command = 'A'; command <= 'Z'; command++) {
+            if (uint64_t count = stats.commandCount(command)) {
+                commands[string(1, command)] = count;
+            }
+        }
+        report["commands"] = commands;
+#endif
+        return report;
+    }
+
+    // Function to print the catalog gauges and a latency table of every operation used so far
+    void printStats() const {
+        json report = statsReport();
+        cout << "\nLibrary statistics:\n";
+        cout << "- Books: " << report["books"] << ", patrons: " << report["patrons"]
+            << ", available: " << report["available"] << ", checked out: " << report["checkedOut"] << ", loans: " << report["loans"]
+            << " (" << report["overdueLoans"] << " overdue), history events: " << report["historyEvents"]
+            << ", index memory: " << fixed << setprecision(1) << report["indexBytes"].get<uint64_t>() / (1024.0 * 1024.0) << " MB\n";
+        cout << "- String pool: " << report["pooledStrings"] << " strings, "
+            << report["stringPoolBytes"].get<uint64_t>() / (1024.0 * 1024.0) << " MB\n";
+        const json& cache = report["searchCache"];
+        cout << "- Search cache: " << cache["entries"] << " of " << cache["capacity"] << " entries, " << cache["hits"] << " hits, "
+            << cache["misses"] << " misses (" << cache["stale"] << " stale), hit rate " << setprecision(1)
+            << cache["hitRate"].get<double>() * 100 << "%\n";
+        const json& startup = report["startup"];
+        if (currentLoadStage() == LoadStage::Ready) {
+            cout << "- Startup: first prompt after " << setprecision(1) << startup["firstPromptMs"].get<double>() << " ms, catalog loaded in "
+                << startup["loadMs"].get<double>() << " ms\n";
+        }
+        else {
+            cout << "- Startup: " << startup["stage"].get<string>() << "\n";
+        }
+        if (!report.contains("operations")) {
+            cout << "- Operation timings are not compiled into this build.\n";
+            return;
+        }
+        cout << setfill(' ') << left << setw(16) << "operation" << right << setw(10) << "count" << setw(12) << "mean us"
+            << setw(12) << "p50 us" << setw(12) << "p99 us" << setw(12) << "max us" << "\n";
+        for (const auto& entry : report["operations"].items()) {
+            const json& latency = entry.value();
+            if (latency["count"].get<uint64_t>() == 0) {
+                continue;
+            }
+            cout << left << setw(16) << entry.key() << right << setw(10) << latency["count"].get<uint64_t>() << setprecision(2)
+                << setw(12) << latency["meanNs"].get<uint64_t>() / 1000.0 << setw(12) << latency["p50Ns"].get<uint64_t>() / 1000.0
+                << setw(12) << latency["p99Ns"].get<uint64_t>() / 1000.0 << setw(12) << latency["maxNs"].get<uint64_t>() / 1000.0 << "\n";
+        }
+    }
+
+    // Function to write the statistics to statsFile if statsInterval has passed since the
+    // last dump. The file is replaced atomically so readers never see half a report
+    void dumpStatsIfDue() {
+        int64_t now = chrono::steady_clock::now().time_since_epoch().count();
+        int64_t due = nextStatsDump.load();
+        if (now < due || !nextStatsDump.compare_exchange_strong(due, now + chrono::duration_cast<chrono::steady_clock::duration>(statsInterval).count())) {
+            return;
+        }
+        string tempFile = statsFile + ".tmp";
+        {
+            ofstream outFile(tempFile);
+            if (!outFile.is_open()) {
+                return;
+            }
+            outFile << statsReport().dump(4);
+        }
+        error_code ec;
+        filesystem::rename(tempFile, statsFile, ec);
+    }
+
+    // Function to move the startup load to its next stage. Ready records how long the load took
+    // and wakes every command waiting for it
+    void setLoadStage(LoadStage stage) {
+        {
+            lock_guard<mutex> loadGuard(loadMutex);
+            if (stage == LoadStage::Recovering) {
+                loadStart = chrono::steady_clock::now();
+            }
+            else if (stage == LoadStage::Ready) {
+                loadMicros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - loadStart).count();
+            }
+            loadStage = stage;
+        }
+        loadChanged.notify_all();
+    }
+
+    LoadStage currentLoadStage() const { return loadStage.load(); }
+
+    // Function to wait until the startup load has reached stage
+    void waitForLoad(LoadStage stage = LoadStage::Ready) {
+        unique_lock<mutex> loadGuard(loadMutex);
+        loadChanged.wait(loadGuard, [this, stage] { return loadStage.load() >= stage; });
+    }
+
+    // Function to describe how far the startup load has come
+    string loadStatus() const {
+        static const char* const stages[] = { "recovering from the journal", "reading the catalog file", "adding test patrons", "ready" };
+        LoadStage stage = loadStage.load();
+        ostringstream status;
+        status << stages[static_cast<size_t>(stage)];
+        if (stage == LoadStage::ReadingFile && loadFileBytes.load() > 0) {
+            status << ", " << loadedBytes.load() * 100 / loadFileBytes.load() << "% (" << loadedRecords.load() << " records)";
+        }
+        if (stage != LoadStage::Ready) {
+            lock_guard<mutex> loadGuard(loadMutex);
+            status << ", " << fixed << setprecision(1) << chrono::duration<double>(chrono::steady_clock::now() - loadStart).count() << " s";
+        }
+        return status.str();
+    }
+
+    // Function to record how long the program took to show its first command prompt, not
+    // counting the time the user spent typing
+    void recordFirstPrompt(chrono::steady_clock::duration elapsed) {
+        firstPromptMicros = chrono::duration_cast<chrono::microseconds>(elapsed).count();
+    }
+
+    // Function to publish the catalog to imageFile for replicas from now on
+    void setCatalogImage(const string& fileName) {
+        imageFile = fileName;
+    }
+
+    // Function to write the catalog, its indexes and the books on the shelf as the next
+    // generation of a catalog image. The locks are held only while the books are collected: the
+    // pool of the strings they point at is held, so the image is sorted and written with desks busy
+    bool publishCatalogImage(const string& fileName) {
+        StatTimer timer(stats, StatOp::PublishImage);
+        lock_guard<mutex> publishGuard(publishMutex);
+        catalogimage::Builder builder;
+        uint64_t changes;
+        shared_ptr<const StringPool> pinned;
+        {
+            shared_lock<ShardedSharedMutex> catalogGuard(catalogLock);
+            lock_guard<mutex> loanGuard(loanMutex);
+            pinned = strings;
+            changes = catalogChanges.load();
+            builder.reserve(books.size());
+            for (const Book& book : books) {
+                builder.addBook(book.title, book.author, book.titleKey, book.authorKey, book.checkedOut);
+            }
+        }
+        // Generations carry on from an image left by an earlier run, so replicas never go back
+        if (imageGeneration == 0) {
+            catalogimage::Reader previous;
+            if (previous.open(fileName)) {
+                imageGeneration = previous.info().generation;
+            }
+        }
+        if (!builder.write(fileName, imageGeneration + 1, time(nullptr))) {
+            cerr << "Unable to publish catalog image " << fileName << ".\n";
+            return false;
+        }
+        imageGeneration++;
+        publishedChanges = changes;
+        return true;
+    }
+
+    // Function to republish the catalog image if imageInterval has passed since the last
+    // publish and anything changed since
+    void publishImageIfDue() {
+        if (imageFile.empty()) {
+            return;
+        }
+        int64_t now = chrono::steady_clock::now().time_since_epoch().count();
+        int64_t due = nextImagePublish.load();
+        if (now < due || catalogChanges.load(memory_order_relaxed) == publishedChanges.load()
+            || !nextImagePublish.compare_exchange_strong(due, now + chrono::duration_cast<chrono::steady_clock::duration>(imageInterval).count())) {
+            return;
+        }
+        publishCatalogImage(imageFile);
+    }
+
+    void addPatronsForTesting(string first, string last) {
+        insertPatron(first, last);
+    }
+
+    void checkOutBooksForTestPatrons(const vector<CirculationRequest>& loans) {
+        applyCirculation(loans);
+    }
+
+};
+
+
+// Container policies, chosen at compile time: -DBERRY_BOOK_STORE and -DBERRY_PATRON_STORE each
+// take SlotMap (the default), DequeStore or FlatStore, any HandleStore template will do. Every
+// pairing builds and gives the same batch output; --compare-stores times only the book stores,
+// patrons are few and rarely removed
+#ifndef BERRY_BOOK_STORE
+#define BERRY_BOOK_STORE SlotMap
+#endif
+#ifndef BERRY_PATRON_STORE
+#define BERRY_PATRON_STORE SlotMap
+#endif
+using BerryLibrary = Library<BERRY_BOOK_STORE<Book>, BERRY_PATRON_STORE<Patron>, vector<Person>>;
+
+// Deterministic catalog generator for the benchmarks, the same seed always yields the same
+// titles, authors and patrons
+class CatalogGenerator {
+private:
+    uint64_t state;
+    static constexpr const char* words[] = { "Art", "Science", "Programming", "Systems", "Data", "Learning", "Networks",
+        "Design", "Theory", "Practice", "Modern", "Introduction", "Advanced", "Algorithms", "History", "Guide" };
+    static constexpr const char* firstNames[] = { "John", "Jane", "Alice", "Bob", "Emily", "Michael", "Sarah", "David",
+        "Laura", "James", "Olivia", "William", "Sophia", "Daniel", "Grace", "Henry" };
+    static constexpr const char* lastNames[] = { "Doe", "Smith", "Johnson", "Williams", "Brown", "Davis", "Clark", "Miller",
+        "Wilson", "Taylor", "Anderson", "Thomas", "Moore", "Martin", "Lee", "Walker" };
+
+public:
+    explicit CatalogGenerator(uint64_t seed = 2550) : state(seed) {}
+
+    // splitmix64
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    size_t below(size_t bound) { return static_cast<size_t>(next() % bound); }
+
+    // Titles are unique per index, authors repeat so author searches return several books
+    string title(size_t i) {
+        return string("The ") + words[below(16)] + " of " + words[below(16)] + " " + words[below(16)] + " " + to_string(i);
+    }
+    string authorFirst(size_t i) { return firstNames[i % 16] + to_string(i / 256 % 64); }
+    string authorLast(size_t i) { return lastNames[i / 16 % 16]; }
+    string patronFirst(size_t i) { return firstNames[i % 16]; }
+    string patronLast(size_t i) { return lastNames[i / 16 % 16] + to_string(i / 256); }
+};
+
+// Stream buffer that discards everything, used to keep library messages out of benchmark output
+class NullBuffer : public streambuf {
+protected:
+    int overflow(int c) override { return c; }
+};
+
+// Function to read the anonymous (private, not file-backed) resident memory of the process in
+// KB from /proc, 0 where unsupported
+size_t privateRssKb() {
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.rfind("RssAnon:", 0) == 0) {
+            return static_cast<size_t>(strtoull(line.c_str() + 8, nullptr, 10));
+        }
+    }
+    return 0;
+}
+
+// Heap allocations made while counting is switched on, so the benchmarks can report them. The
+// global operator new is replaced only in builds with statistics; when counting is off it
+// costs one relaxed load per allocation
+#ifndef BERRY_NO_STATS
+atomic<bool> countingAllocations{ false };
+atomic<uint64_t> heapAllocations{ 0 };
+
+void* operator new(size_t size) {
+    if (countingAllocations.load(memory_order_relaxed)) {
+        heapAllocations.fetch_add(1, memory_order_relaxed);
+    }
+    if (void* memory = malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw bad_alloc();
+}
+// Kept out of line so the compiler does not pair an inlined free with a new expression
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void* memory) noexcept { free(memory); }
+void operator delete(void* memory, size_t) noexcept { ::operator delete(memory); }
+
+void countAllocations(bool on) { countingAllocations = on; }
+uint64_t allocationCount() { return heapAllocations.load(memory_order_relaxed); }
+#else
+void countAllocations(bool) {}
+uint64_t allocationCount() { return 0; }
+#endif
+
+struct BenchResult {
+    string name;
+    size_t ops = 0;
+    double seconds = 0, p50 = 0, p99 = 0, allocsPerOp = 0;
+};
+
+// Function to time op(i) for up to maxOps calls or until the time budget runs out, keeping
+// every sample so the percentiles are exact
+template<typename Op>
+BenchResult measure(const string& name, size_t maxOps, Op op, double budgetSeconds = 2.0) {
+    vector<double> samples;
+    samples.reserve(maxOps);
+    uint64_t allocationsBefore = allocationCount();
+    auto begin = chrono::steady_clock::now();
+    for (size_t i = 0; i < maxOps; i++) {
+        auto start = chrono::steady_clock::now();
+        op(i);
+        auto stop = chrono::steady_clock::now();
+        samples.push_back(chrono::duration<double, micro>(stop - start).count());
+        if (chrono::duration<double>(stop - begin).count() > budgetSeconds) {
+            break;
+        }
+    }
+    BenchResult result;
+    result.name = name;
+    result.ops = samples.size();
+    result.allocsPerOp = samples.empty() ? 0 : static_cast<double>(allocationCount() - allocationsBefore) / samples.size();
+    for (double sample : samples) {
+        result.seconds += sample / 1e6;
+    }
+    auto percentile = [&samples](double p) {
+        auto nth = samples.begin() + static_cast<ptrdiff_t>(p * (samples.size() - 1));
+        nth_element(samples.begin(), nth, samples.end());
+        return *nth;
+    };
+    if (!samples.empty()) {
+        result.p50 = percentile(0.50);
+        result.p99 = percentile(0.99);
+    }
+    return result;
+}
+
+// Function to benchmark every library operation on a generated catalog and append the
+// results to the json report
+template<typename LibraryType>
+void runBenchmark(size_t bookCount, size_t patronCount, json& report) {
+    const size_t opsPerTest = 10000;
+    CatalogGenerator generator;
+    NullBuffer nullBuffer;
+    streambuf* console = cout.rdbuf();
+    vector<BenchResult> results;
+
+    LibraryType library;
+    vector<string> titles;
+    titles.reserve(bookCount);
+    // The allocations of the build include those of the generated strings themselves
+    uint64_t allocationsBefore = allocationCount();
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < bookCount; i++) {
+        titles.push_back(generator.title(i));
+        size_t author = generator.below(bookCount);
+        library.insertBook(titles.back(), generator.authorFirst(author) + " " + generator.authorLast(author));
+    }
+    for (size_t i = 0; i < patronCount; i++) {
+        library.insertPatron(generator.patronFirst(i), generator.patronLast(i));
+    }
+    double buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    uint64_t buildAllocations = allocationCount() - allocationsBefore;
+    json gauges = library.statsReport();
+
+    results.push_back(measure("search title", opsPerTest, [&](size_t) {
+        library.lookupTitle(titles[generator.below(bookCount)]);
+        }));
+    results.push_back(measure("search author", opsPerTest, [&](size_t) {
+        size_t author = generator.below(bookCount);
+        size_t found = 0;
+        library.forEachBookByAuthor(generator.authorFirst(author) + " " + generator.authorLast(author), [&found](const Book&) { found++; });
+        }));
+
+    // Partial queries are the tail of a title (selective, it holds the title number) or a middle
+    // slice made only of common words. Fuzzy queries are a middle slice with one character changed
+    results.push_back(measure("search partial", opsPerTest, [&](size_t) {
+        const string& title = titles[generator.below(bookCount)];
+        library.searchCatalog(title.substr(title.size() - 12));
+        }));
+    results.push_back(measure("search common", opsPerTest, [&](size_t) {
+        const string& title = titles[generator.below(bookCount)];
+        library.searchCatalog(title.substr(title.size() / 3, 12));
+        }));
+    results.push_back(measure("search fuzzy", opsPerTest, [&](size_t) {
+        string query = titles[generator.below(bookCount)];
+        query = query.substr(query.size() / 3, 12);
+        query[query.size() / 2] = 'x';
+        library.searchCatalog(query);
+        }));
+    // Desk traffic repeats itself: a few hundred popular queries, the most popular drawn most often
+    vector<string> popular;
+    for (size_t i = 0; i < 256; i++) {
+        const string& title = titles[generator.below(bookCount)];
+        popular.push_back(i % 2 ? title.substr(title.size() - 12) : title.substr(title.size() / 3, 12));
+    }
+    results.push_back(measure("search popular", opsPerTest, [&](size_t) {
+        library.searchCatalog(popular[min(generator.below(popular.size()), generator.below(popular.size()))]);
+        }));
+
+    // Every checkout gets a distinct book so the matching return always succeeds
+    size_t loanOps = min(opsPerTest, bookCount);
+    vector<pair<size_t, size_t>> loans(loanOps);
+    for (size_t i = 0; i < loanOps; i++) {
+        loans[i] = { generator.below(patronCount), i * (bookCount / loanOps) };
+    }
+    results.push_back(measure("checkout", loanOps, [&](size_t i) {
+        library.checkOut(generator.patronFirst(loans[i].first), generator.patronLast(loans[i].first), titles[loans[i].second]);
+        }));
+    size_t returned = results.back().ops;
+    results.push_back(measure("return", returned, [&](size_t i) {
+        library.checkIn(generator.patronFirst(loans[i].first), generator.patronLast(loans[i].first), titles[loans[i].second]);
+        }));
+    // The same loans as bulk batches, one op is a batch of bulkSize checkouts or returns
+    const size_t bulkSize = 1000;
+    vector<CirculationRequest> bulkOut, bulkBack;
+    for (size_t i = 0; i < returned; i++) {
+        bulkOut.push_back({ generator.patronFirst(loans[i].first), generator.patronLast(loans[i].first), titles[loans[i].second], CirculationEvent::CheckOut });
+        bulkBack.push_back(bulkOut.back());
+        bulkBack.back().action = CirculationEvent::Return;
+    }
+    size_t bulkOps = returned / bulkSize;
+    results.push_back(measure("bulk checkout 1k", bulkOps, [&](size_t i) {
+        library.applyCirculation(span<const CirculationRequest>(bulkOut).subspan(i * bulkSize, bulkSize));
+        }));
+    results.push_back(measure("bulk return 1k", results.back().ops, [&](size_t i) {
+        library.applyCirculation(span<const CirculationRequest>(bulkBack).subspan(i * bulkSize, bulkSize));
+        }));
+
+    vector<string> extraTitles;
+    results.push_back(measure("add book", opsPerTest, [&](size_t i) {
+        extraTitles.push_back(generator.title(bookCount + i));
+        library.insertBook(extraTitles.back(), "Bench Author");
+        }));
+    results.push_back(measure("remove book", extraTitles.size(), [&](size_t i) {
+        library.eraseBook(extraTitles[i], "Bench Author");
+        }));
+
+    size_t listed = 0;
+    results.push_back(measure("list by title", 3, [&](size_t) {
+        library.forEachBookInOrder(BookOrder::Title, [&listed](const Book&) { listed++; });
+        }, 10.0));
+    results.push_back(measure("list by author", 3, [&](size_t) {
+        library.forEachBookInOrder(BookOrder::Author, [&listed](const Book&) { listed++; });
+        }, 10.0));
+    results.push_back(measure("count available", opsPerTest, [&](size_t) {
+        listed += library.availableCount();
+        }));
+    results.push_back(measure("list available", 3, [&](size_t) {
+        library.forEachAvailableBook([&listed](const Book&) { listed++; });
+        }, 10.0));
+
+    string benchFile = "berry_bench_catalog.json";
+    cout.rdbuf(&nullBuffer);
+    results.push_back(measure("writeToLogFile", 1, [&](size_t) { library.writeToLogFile(benchFile); }));
+    {
+        LibraryType reloaded;
+        results.push_back(measure("readFromFile", 1, [&](size_t) { reloaded.readFromFile(benchFile); }));
+    }
+    cout.rdbuf(console);
+    remove(benchFile.c_str());
+
+    {
+        string auditFile = "berry_bench_audit.txt";
+        AuditLog audit;
+        audit.open(auditFile);
+        results.push_back(measure("audit event", opsPerTest, [&](size_t i) {
+            audit.record("CHECKOUT", { "Sarah", "Lee", titles[i % bookCount] });
+            }));
+        audit.close();
+        remove(auditFile.c_str());
+    }
+
+    size_t peakKb = peakRssKb();
+    cout << "\n== " << bookCount << " books, " << patronCount << " patrons (built in " << fixed << setprecision(2) << buildSeconds
+        << " s with " << buildAllocations << " allocations, peak RSS " << peakKb / 1024 << " MB, string pool "
+        << gauges["stringPoolBytes"].get<uint64_t>() / (1024 * 1024) << " MB) ==\n";
+    cout << left << setw(18) << setfill(' ') << "operation" << right << setw(10) << "ops" << setw(14) << "ops/sec"
+        << setw(12) << "p50 us" << setw(12) << "p99 us" << setw(14) << "allocs/op" << "\n";
+    json sizeReport = { {"books", bookCount}, {"patrons", patronCount}, {"buildSeconds", buildSeconds},
+        {"buildAllocations", buildAllocations}, {"peakRssKb", peakKb}, {"stringPoolBytes", gauges["stringPoolBytes"]} };
+    for (const BenchResult& result : results) {
+        double throughput = result.seconds > 0 ? result.ops / result.seconds : 0;
+        cout << left << setw(18) << result.name << right << setw(10) << result.ops << setw(14) << setprecision(0) << throughput
+            << setw(12) << setprecision(2) << result.p50 << setw(12) << result.p99 << setw(14) << result.allocsPerOp << "\n";
+        sizeReport["operations"].push_back({ {"name", result.name}, {"ops", result.ops}, {"opsPerSec", throughput},
+            {"p50Us", result.p50}, {"p99Us", result.p99}, {"allocsPerOp", result.allocsPerOp} });
+    }
+    report.push_back(sizeReport);
+}
+
+// Function to run the benchmark suite over several catalog sizes and save a json report
+// that can be compared across builds
+template<typename LibraryType>
+int runBenchmarks(const vector<size_t>& bookCounts, const string& reportFile) {
+    json report = json::array();
+    countAllocations(true);
+    for (size_t bookCount : bookCounts) {
+        size_t patronCount = max<size_t>(1, min<size_t>(bookCount / 10, 1000000));
+        runBenchmark<LibraryType>(bookCount, patronCount, report);
+    }
+    ofstream outFile(reportFile);
+    if (!outFile.is_open()) {
+        cerr << "Unable to write benchmark report " << reportFile << ".\n";
+        return 1;
+    }
+    outFile << report.dump(4);
+    cout << "\nBenchmark report written to " << reportFile << "\n";
+    return 0;
+}
+
+// Throughput of one container policy under each workload
+struct StoreResult {
+    string name;
+    double buildSeconds = 0, readOpsPerSec = 0, churnOpsPerSec = 0, scanMs = 0;
+    size_t characters = 0;
+};
+
+// Function to call op(i) in rounds until the time budget runs out, returning operations per second
+template<typename Op>
+double opsPerSecond(double budgetSeconds, Op op) {
+    size_t done = 0;
+    auto start = chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < budgetSeconds) {
+        for (size_t i = 0; i < 1000; i++, done++) {
+            op(done);
+        }
+        elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    return done / elapsed;
+}
+
+// Function to measure one library configuration on a generated catalog. The read-heavy mix is
+// 80% title lookups, 10% author lookups and 10% checkouts and returns; the churn-heavy mix adds
+// a book and removes a random one, in turns. The catalog walk runs after the churn. Patrons are
+// few so that the patron lookup does not drown out the book store
+template<typename LibraryType>
+StoreResult measureStore(const string& name, size_t bookCount, double seconds) {
+    CatalogGenerator generator;
+    StoreResult result;
+    result.name = name;
+    const size_t patronCount = 64;
+
+    LibraryType library;
+    vector<pair<string, string>> live;
+    live.reserve(bookCount);
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < bookCount; i++) {
+        size_t author = generator.below(bookCount);
+        live.emplace_back(generator.title(i), generator.authorFirst(author) + " " + generator.authorLast(author));
+        library.insertBook(live.back().first, live.back().second);
+    }
+    for (size_t i = 0; i < patronCount; i++) {
+        library.insertPatron(generator.patronFirst(i), generator.patronLast(i));
+    }
+    result.buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    size_t book = 0, patron = 0;
+    result.readOpsPerSec = opsPerSecond(seconds, [&](size_t i) {
+        switch (i % 20) {
+        case 0:
+            book = generator.below(bookCount);
+            patron = generator.below(patronCount);
+            library.checkOut(generator.patronFirst(patron), generator.patronLast(patron), live[book].first);
+            break;
+        case 1:
+            library.checkIn(generator.patronFirst(patron), generator.patronLast(patron), live[book].first);
+            break;
+        case 2:
+        case 3: {
+            size_t found = 0;
+            library.forEachBookByAuthor(live[generator.below(bookCount)].second, [&found](const Book&) { found++; });
+            break;
+        }
+        default:
+            library.lookupTitle(live[generator.below(bookCount)].first);
+            break;
+        }
+        });
+
+    size_t added = 0;
+    result.churnOpsPerSec = opsPerSecond(seconds, [&](size_t i) {
+        if (i % 2 == 0) {
+            size_t author = generator.below(bookCount);
+            live.emplace_back(generator.title(bookCount + added++), generator.authorFirst(author) + " " + generator.authorLast(author));
+            library.insertBook(live.back().first, live.back().second);
+            return;
+        }
+        size_t victim = generator.below(live.size());
+        library.eraseBook(live[victim].first, live[victim].second);
+        swap(live[victim], live.back());
+        live.pop_back();
+        });
+
+    // The characters walked are printed so the walk cannot be optimized away
+    size_t characters = 0;
+    start = chrono::steady_clock::now();
+    library.forEachBookInOrder(BookOrder::Added, [&characters](const Book& book) { characters += book.title.size(); });
+    result.scanMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    result.characters = characters;
+    return result;
+}
+
+// Function to compare the shipped container policies on the same workloads
+int compareStores(size_t bookCount, double seconds) {
+    cout << "Container policies: " << bookCount << " books, " << seconds << " s per workload\n";
+    vector<StoreResult> results;
+    results.push_back(measureStore<Library<SlotMap<Book>, SlotMap<Patron>, vector<Person>>>("slot map", bookCount, seconds));
+    results.push_back(measureStore<Library<DequeStore<Book>, SlotMap<Patron>, vector<Person>>>("deque", bookCount, seconds));
+    results.push_back(measureStore<Library<FlatStore<Book>, SlotMap<Patron>, vector<Person>>>("flat", bookCount, seconds));
+    results.push_back(measureStore<Library<SlotMap<Book>, DequeStore<Patron>, deque<Person>>>("slot map, deque patrons", bookCount, seconds));
+
+    cout << "\n" << left << setw(26) << setfill(' ') << "policy" << right << setw(10) << "build s" << setw(14) << "read ops/s"
+        << setw(14) << "churn ops/s" << setw(10) << "walk ms" << "\n";
+    for (const StoreResult& result : results) {
+        cout << left << setw(26) << result.name << right << fixed << setprecision(2) << setw(10) << result.buildSeconds
+            << setprecision(0) << setw(14) << result.readOpsPerSec << setw(14) << result.churnOpsPerSec
+            << setprecision(2) << setw(10) << result.scanMs << "  (" << result.characters << " title characters)\n";
+    }
+    auto best = [&results](double StoreResult::* field) {
+        return max_element(results.begin(), results.end(), [field](const StoreResult& a, const StoreResult& b) {
+            return a.*field < b.*field;
+            })->name;
+    };
+    auto fastestWalk = min_element(results.begin(), results.end(), [](const StoreResult& a, const StoreResult& b) {
+        return a.scanMs < b.scanMs;
+        });
+    cout << "\nRead-heavy: " << best(&StoreResult::readOpsPerSec) << " wins, churn-heavy: " << best(&StoreResult::churnOpsPerSec)
+        << " wins, catalog walk: " << fastestWalk->name << " wins\n";
+    return 0;
+}
+
+// Function to time the circulation reports over a generated history of a year: a catalog of
+// books and patrons drawn with a skew so that some titles and patrons are far busier than others
+int runHistoryBench(size_t eventCount) {
+    const size_t titleCount = 100000, patronCount = 20000;
+    const int64_t day = 24 * 60 * 60, start = CirculationLog::timeEpoch + 1000 * day;
+    CatalogGenerator generator;
+    // Books and patrons are coded up front, as the library does on their first event
+    CirculationLog history;
+    vector<uint32_t> bookCodes, patronCodes;
+    for (size_t i = 0; i < titleCount; i++) {
+        size_t author = i % 5000;
+        bookCodes.push_back(history.bookCode(generator.title(i), generator.authorFirst(author) + " " + generator.authorLast(author)));
+    }
+    for (size_t i = 0; i < patronCount; i++) {
+        patronCodes.push_back(history.patronCode(generator.patronFirst(i), generator.patronLast(i)));
+    }
+    // The minimum of two draws favors small indexes
+    auto skewed = [&generator](size_t bound) { return min(generator.below(bound), generator.below(bound)); };
+
+    auto begin = chrono::steady_clock::now();
+    for (size_t i = 0; i < eventCount; i++) {
+        history.record(i % 2 ? CirculationEvent::Return : CirculationEvent::CheckOut, bookCodes[skewed(titleCount)],
+            patronCodes[skewed(patronCount)], start + static_cast<int64_t>(i * 365 * day / eventCount));
+    }
+    double fillSeconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    cout << "Circulation history: " << eventCount << " events over 365 days, recorded in " << fixed << setprecision(2)
+        << fillSeconds << " s (" << static_cast<uint64_t>(eventCount / fillSeconds) << " events/sec)\n\n";
+
+    int64_t end = start + 365 * day, lastMonth = end - 30 * day;
+    cout << left << setw(28) << setfill(' ') << "query" << right << setw(12) << "ms" << "\n";
+    auto timed = [](const string& name, auto query) {
+        auto queryStart = chrono::steady_clock::now();
+        auto result = query();
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - queryStart).count();
+        cout << left << setw(28) << name << right << setw(12) << setprecision(1) << ms << "\n";
+        return result;
+    };
+    auto top = timed("top 10 titles, year", [&] { return history.topTitles(10, start, end); });
+    timed("top 10 authors, year", [&] { return history.topAuthors(10, start, end); });
+    timed("top 10 patrons, year", [&] { return history.topPatrons(10, start, end); });
+    timed("top 10 titles, 30 days", [&] { return history.topTitles(10, lastMonth, end); });
+    timed("activity per day, year", [&] { return history.activity(start, end, day); });
+    timed("activity per hour, year", [&] { return history.activity(start, end, 60 * 60); });
+    if (!top.empty()) {
+        cout << "\nMost borrowed: " << top[0].name << " (" << top[0].count << " checkouts)\n";
+    }
+    return 0;
+}
+
+// Function to rebuild the library from the journal. Only a fresh start loads the file and the test data
+void startLibrary(BerryLibrary& library) {
+    library.setLoadStage(LoadStage::Recovering);
+    if (library.recoverFromJournal()) {
+        library.setLoadStage(LoadStage::Ready);
+        return;
+    }
+    //For submission only, normally called by case 'R' and user types file to read from
+    library.setLoadStage(LoadStage::ReadingFile);
+    library.readFromFile();
+    library.setLoadStage(LoadStage::AddingTestData);
+
+
+    /*For submission only, Added this while double checking the rubric before submission bc I noticed the comment not to make you add any files,
+    I assumed that meant test data too. I had planned for the user(librarian) to add patrons and for none to exist until the librarian added them.
+    I added these test users so all the functions are usable immediately after compiling the program.
+    The ones effected by this if I didnt add the test data were checkout book, return book, view all patrons, search patron and then view all books checked out to that patron.
+    */
+    library.addPatronsForTesting("Sarah", "Lee");
+    library.addPatronsForTesting("Sam", "Dunfey");
+    library.addPatronsForTesting("James", "Jones");
+    library.addPatronsForTesting("Candace", "Baker");
+    library.checkOutBooksForTestPatrons({
+        { "Sarah", "Lee", "Python Programming", CirculationEvent::CheckOut },
+        { "Sam", "Dunfey", "Web Development Crash Course", CirculationEvent::CheckOut },
+        { "James", "Jones", "The Art of Programming VOL2", CirculationEvent::CheckOut },
+        { "James", "Jones", "Blockchain Technology Explained", CirculationEvent::CheckOut },
+        { "Candace", "Baker", "Artificial Intelligence Basics", CirculationEvent::CheckOut } });
+    //One more note, the books.json does not have any books checked out.
+    //If you trigger the writeToLogFile function with case W, they will appear checked out.
+    library.commitJournal();
+    library.setLoadStage(LoadStage::Ready);
+}
+
+// Function to run startLibrary on a thread of its own so the first prompt does not wait for the
+// catalog. The library is in the Recovering stage as soon as this returns; loadStatus() tells
+// how far the load has come and waitForLoad() waits for it
+thread startLibraryInBackground(BerryLibrary& library) {
+    library.setLoadStage(LoadStage::Recovering);
+    return thread([&library] {
+        startLibrary(library);
+        library.startOverdueNotices();
+    });
+}
+
+// Function to split a batch line into words, "double quoted" words may contain spaces.
+// Returns false on an unterminated quote
+bool splitCommand(const string& line, vector<string>& words) {
+    words.clear();
+    size_t i = 0;
+    while (i < line.size()) {
+        if (isspace(static_cast<unsigned char>(line[i]))) {
+            i++;
+            continue;
+        }
+        if (line[i] == '"') {
+            size_t close = line.find('"', i + 1);
+            if (close == string::npos) {
+                return false;
+            }
+            words.emplace_back(line, i + 1, close - i - 1);
+            i = close + 1;
+            continue;
+        }
+        size_t end = i;
+        while (end < line.size() && !isspace(static_cast<unsigned char>(line[end]))) {
+            end++;
+        }
+        words.emplace_back(line, i, end - i);
+        i = end;
+    }
+    return true;
+}
+
+// Function to apply a kiosk's circulation file as one bulk batch. The file holds CHECKOUT and
+// RETURN lines written as for runCommand, with blank and # lines skipped. Lines that cannot be
+// parsed or applied are reported by line number, then a summary. Returns false if the file
+// cannot be opened
+template<typename LibraryType>
+bool syncCirculation(LibraryType& library, const string& fileName, ostream& out) {
+    ifstream inFile(fileName);
+    if (!inFile.is_open()) {
+        out << "- Unable to open " << fileName << "\n";
+        return false;
+    }
+    auto start = chrono::steady_clock::now();
+    vector<CirculationRequest> requests;
+    vector<size_t> lineOf;
+    size_t lineNumber = 0, failed = 0;
+    string line;
+    vector<string> words;
+    while (getline(inFile, line)) {
+        lineNumber++;
+        bool parsed = splitCommand(line, words);
+        if (parsed && (words.empty() || words[0][0] == '#')) {
+            continue;
+        }
+        CirculationRequest request;
+        parsed = parsed && (words.size() == 4 || words.size() == 5);
+        if (parsed) {
+            request = { words[1], words[2], words[3], CirculationEvent::CheckOut };
+            if (CaseInsensitiveEqual()(words[0], "CHECKOUT")) {
+                parsed = words.size() == 4 || parseDueDate(words[4], request.due);
+            }
+            else {
+                request.action = CirculationEvent::Return;
+                parsed = CaseInsensitiveEqual()(words[0], "RETURN") && words.size() == 4;
+            }
+        }
+        if (!parsed) {
+            out << "- line " << lineNumber << ": not a CHECKOUT or RETURN\n";
+            failed++;
+            continue;
+        }
+        requests.push_back(move(request));
+        lineOf.push_back(lineNumber);
+    }
+    vector<OpStatus> statuses = library.applyCirculation(requests);
+    size_t applied = 0;
+    for (size_t i = 0; i < statuses.size(); i++) {
+        if (statuses[i] == OpStatus::Ok) {
+            applied++;
         }
         else {
-            cout << "Book not found in the library.\n";
+            out << "- line " << lineOf[i] << ": " << statusMessage(statuses[i]) << "\n";
+            failed++;
         }
-
     }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    out << "- Synced " << applied << " of " << applied + failed << " checkouts and returns from " << fileName << " in "
+        << fixed << setprecision(1) << ms << " ms\n";
+    return true;
+}
 
-    // Function to check out a book
-    void checkOutBook() {
-        string patronFirstName, patronLastName, bookTitle;
-        cout << "Enter patron first name: ";
-        cin >> patronFirstName;
-        cout << "Enter patron last name: ";
-        cin >> patronLastName;
-        cout << "Enter book title to check out: ";
-        cin.ignore();
-        getline(cin, bookTitle);
-
-        bool patronFound = false;
-        for (Patron& patron : patrons) {
-            if (lower(patron.getFirstName()) == lower(patronFirstName) && lower(patron.getLastName()) == lower(patronLastName)) {
-                patronFound = true;
-                for (Book& book : books) {
-                    if (lower(book.title) == lower(bookTitle)) {
-                        if (!book.checkedOut) {
-                            book.checkedOut = true;
-                            patron.checkOutBook(&book);
-                            cout << book.title << " has been checked out by " << patronFirstName << " " << patronLastName << endl;
-                            return;
-                        }
-                        else {
-                            cout << "Book is already checked out.\n";
-                            return;
-                        }
-                    }
-                }
-                cout << "Book not found.\n";
-                return;
-            }
+// Function to run one command without prompts, writing query results to out as "- " lines.
+// Returns false for an unknown command or the wrong number of arguments:
+//   ADD "Title" AuthorFirst AuthorLast       REMOVE "Title" AuthorFirst AuthorLast
+//   CHECKOUT First Last "Title" [YYYY-MM-DD] RETURN First Last "Title"
+//   ADDPATRON First Last                     REMOVEPATRON First Last
+//   FIND "part of a title or author"         AUTHOR AuthorFirst AuthorLast
+//   IMPORT file-or-directory ...             HISTORY days (0 for the whole history)
+//   OVERDUE                                  AVAILABLE [AUTHOR AuthorFirst AuthorLast | TITLE "prefix"]
+//   SYNC circulation-file (CHECKOUT and RETURN lines applied as one batch)
+//   EXPORT file [COMPACT] [CHECKEDOUT | AVAILABLE]
+// A CHECKOUT without a due date is due after the loan period
+template<typename LibraryType>
+bool runCommand(LibraryType& library, vector<string>& words, ostream& out, OpStatus& status) {
+    string& command = words[0];
+    transform(command.begin(), command.end(), command.begin(), [](unsigned char c) { return static_cast<char>(toupper(c)); });
+    status = OpStatus::Ok;
+    if ((command == "ADD" || command == "REMOVE") && words.size() == 4) {
+        string author = words[2] + " " + words[3];
+        if (command == "ADD") {
+            status = library.insertBook(words[1], author);
+        }
+        else {
+            status = library.eraseBook(words[1], author);
         }
-        cout << "Patron not found.\n";
     }
-
-    // Function to return a book
-    void returnBook() {
-        string patronFirstName, patronLastName, bookTitle;
-        cout << "Enter patron first name: ";
-        cin >> patronFirstName;
-        cout << "Enter patron last name: ";
-        cin >> patronLastName;
-        cout << "Enter book title to return: ";
-        cin.ignore();
-        getline(cin, bookTitle);
-
-        bool patronFound = false;
-        for (Patron& patron : patrons) {
-            if (patron.getFirstName() == patronFirstName && patron.getLastName() == patronLastName) {
-                patronFound = true;
-                for (Book& book : books) {
-                    if (lower(book.title) == lower(bookTitle)) {
-                        if (book.checkedOut) {
-                            book.checkedOut = false;
-                            patron.returnBook(bookTitle);
-                            cout << book.title << " has been returned by " << patronFirstName << " " << patronLastName << endl;
-                            return;
-                        }
-                        else {
-                            cout << "Book is not checked out.\n";
-                            return;
-                        }
-                    }
-                }
-                cout << "Book not found.\n";
-                return;
+    else if ((command == "CHECKOUT" || command == "RETURN") && words.size() == 4) {
+        status = command == "CHECKOUT" ? library.checkOut(words[1], words[2], words[3]) : library.checkIn(words[1], words[2], words[3]);
+    }
+    else if (command == "CHECKOUT" && words.size() == 5) {
+        int64_t due;
+        if (!parseDueDate(words[4], due)) {
+            return false;
+        }
+        status = library.checkOut(words[1], words[2], words[3], due);
+    }
+    else if (command == "AVAILABLE" && (words.size() == 1 || (words.size() == 3 && CaseInsensitiveEqual()(words[1], "TITLE"))
+        || (words.size() == 4 && CaseInsensitiveEqual()(words[1], "AUTHOR")))) {
+        auto print = [&out](const Book& book) { out << "- " << book.title << " by " << book.author << "\n"; };
+        if (words.size() == 1) {
+            library.forEachAvailableBook(print);
+        }
+        else if (words.size() == 3) {
+            library.forEachAvailableTitle(words[2], print);
+        }
+        else {
+            library.forEachAvailableBookByAuthor(words[2] + " " + words[3], print);
+        }
+    }
+    else if (command == "EXPORT" && words.size() >= 2 && words.size() <= 4) {
+        jsonexport::Options options;
+        for (size_t i = 2; i < words.size(); i++) {
+            if (CaseInsensitiveEqual()(words[i], "COMPACT")) {
+                options.pretty = false;
             }
+            else if (CaseInsensitiveEqual()(words[i], "CHECKEDOUT")) {
+                options.filter = jsonexport::Filter::CheckedOut;
+            }
+            else if (CaseInsensitiveEqual()(words[i], "AVAILABLE")) {
+                options.filter = jsonexport::Filter::Available;
+            }
+            else {
+                return false;
+            }
+        }
+        jsonexport::Report report;
+        if (library.exportBooks(words[1], options, report)) {
+            printExportReport(report, out);
+        }
+        else {
+            out << "- Unable to write " << words[1] << "\n";
         }
-        cout << "Patron not found.\n";
     }
-
-    // Function to sort books by title
-    void sortBooksByTitle() {
-        sort(books.begin(), books.end(), [](const Book& a, const Book& b) {
-            return a.title < b.title;
+    else if (command == "SYNC" && words.size() == 2) {
+        syncCirculation(library, words[1], out);
+    }
+    else if (command == "OVERDUE" && words.size() == 1) {
+        library.forEachOverdueLoan([&out](const Book& book, const Patron& patron, int64_t due) {
+            out << "- " << book.title << " by " << book.author << ", checked out by " << patron.getFirstName() << " "
+                << patron.getLastName() << ", due " << formatDate(due) << "\n";
             });
     }
-
-    // Function to sort books by author
-    void sortBooksByAuthor() {
-        sort(books.begin(), books.end(), [](const Book& a, const Book& b) {
-            return a.author < b.author;
+    else if (command == "ADDPATRON" && words.size() == 3) {
+        status = library.insertPatron(words[1], words[2]);
+    }
+    else if (command == "REMOVEPATRON" && words.size() == 3) {
+        status = library.erasePatron(words[1], words[2]);
+    }
+    else if (command == "FIND" && words.size() == 2) {
+        library.searchCatalog(words[1], 10, [&out](const Book& book, const SearchHit& hit) {
+            out << "- " << book.title << " by " << book.author << " (" << (book.isCheckedOut() ? "Checked out" : "Available") << ")"
+                << (hit.kind == MatchKind::Fuzzy ? " [close match]" : "") << "\n";
+            });
+    }
+    else if (command == "IMPORT" && words.size() >= 2) {
+        auto start = chrono::steady_clock::now();
+        vector<ImportFileReport> reports = library.importCatalogs(vector<string>(words.begin() + 1, words.end()));
+        printImportReports(reports, chrono::duration<double>(chrono::steady_clock::now() - start).count(), out);
+    }
+    else if (command == "HISTORY" && words.size() == 2 && !words[1].empty() && words[1].size() < 10
+        && all_of(words[1].begin(), words[1].end(), [](unsigned char c) { return isdigit(c); })) {
+        library.writeCirculationReport(stoll(words[1]), out);
+    }
+    else if (command == "AUTHOR" && words.size() == 3) {
+        library.forEachBookByAuthor(words[1] + " " + words[2], [&out](const Book& book) {
+            out << "- " << book.title << " (" << (book.isCheckedOut() ? "Checked out" : "Available") << ")\n";
             });
     }
+    else {
+        return false;
+    }
+    return true;
+}
 
-    // Function to prompt user to sort books by title or author
-    void promptSortBy() {
-        char choice;
-        cout << "Sort by (T)itle or (A)uthor? ";
-        cin >> choice;
-        switch (toupper(choice)) {
-        case 'T':
-            sortBooksByTitle();
-            break;
-        case 'A':
-            sortBooksByAuthor();
-            break;
-        default:
-            cout << "Invalid choice. Sorting by title by default.\n";
-            sortBooksByTitle();
-            break;
+// Function to run commands from a stream without prompts, one command per line (see runCommand).
+// Blank lines and lines starting with # are skipped. Failed commands are reported with their
+// line number, the journal is committed in groups. Returns the number of failed commands
+template<typename LibraryType>
+size_t runBatch(LibraryType& library, istream& in, ostream& out) {
+    const size_t commitEvery = 4096;
+    auto start = chrono::steady_clock::now();
+    size_t lineNumber = 0, commands = 0, errors = 0;
+    string line;
+    vector<string> words;
+
+    auto fail = [&out, &errors, &lineNumber](const string& command, const char* message) {
+        out << "line " << lineNumber << ": " << command << ": " << message << "\n";
+        errors++;
+    };
+
+    while (getline(in, line)) {
+        lineNumber++;
+        if (!splitCommand(line, words)) {
+            fail("?", "unterminated quote");
+            continue;
+        }
+        if (words.empty() || words[0][0] == '#') {
+            continue;
+        }
+        commands++;
+
+        OpStatus status;
+        if (!runCommand(library, words, out, status)) {
+            fail(words[0], "unknown command or wrong number of arguments");
+            continue;
+        }
+        if (status != OpStatus::Ok) {
+            fail(words[0], statusMessage(status));
+        }
+        if (commands % commitEvery == 0) {
+            library.commitJournal();
+            library.dumpStatsIfDue();
         }
     }
+    library.commitJournal();
+    library.dumpStatsIfDue();
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    out << "Processed " << commands << " commands in " << fixed << setprecision(3) << seconds << " s ("
+        << static_cast<uint64_t>(seconds > 0 ? commands / seconds : 0) << " commands/sec), " << errors << " errors\n";
+    out.flush();
+    return errors;
+}
 
-    // Function to print all books
-    void printAllBooks() {
-        cout << "\nList of Books:\n";
-        for (const Book& book : books) {
-            cout << "- " << book.title << " by " << book.author << endl;
+// Function to answer catalog queries from a published catalog image without loading the
+// library, one command per line. Like a desk session every command is answered with its
+// results followed by "ok" or "error: <message>", and QUIT ends it:
+//   TITLE "Title"              AUTHOR AuthorFirst AuthorLast
+//   AVAILABLE [AUTHOR AuthorFirst AuthorLast]
+//   STATUS
+// The image is checked for a new generation before each command, and a command is answered
+// from one generation throughout. Returns 1 if no image could be attached
+int runReplica(const string& imageFile, istream& in, ostream& out) {
+    catalogimage::Replica replica(imageFile);
+    if (!replica.refresh()) {
+        cerr << "Unable to attach to the catalog image: " << replica.error << "\n";
+        return 1;
+    }
+    string line;
+    vector<string> words;
+    while (getline(in, line)) {
+        if (!splitCommand(line, words)) {
+            out << "error: unterminated quote\n";
+            continue;
         }
-    } 
+        if (words.empty() || words[0][0] == '#') {
+            continue;
+        }
+        string& command = words[0];
+        transform(command.begin(), command.end(), command.begin(), [](unsigned char c) { return static_cast<char>(toupper(c)); });
+        if (command == "QUIT" && words.size() == 1) {
+            out << "ok\n";
+            break;
+        }
+        replica.refresh();
+        shared_ptr<const catalogimage::Reader> image = replica.image();
+        auto print = [&image, &out](uint64_t position) {
+            const catalogimage::Book& book = image->books()[position];
+            out << "- " << image->str(book.title) << " by " << image->str(book.author) << " ("
+                << (image->available(position) ? "Available" : "Checked out") << ")\n";
+        };
+        if (command == "TITLE" && words.size() == 2) {
+            image->forEachCopy(words[1], print);
+        }
+        else if (command == "AUTHOR" && words.size() == 3) {
+            image->forEachBookByAuthor(words[1] + " " + words[2], print);
+        }
+        else if (command == "AVAILABLE" && words.size() == 1) {
+            image->forEachAvailable(print);
+        }
+        else if (command == "AVAILABLE" && words.size() == 4 && CaseInsensitiveEqual()(words[1], "AUTHOR")) {
+            image->forEachBookByAuthor(words[2] + " " + words[3], [&image, &print](uint64_t position) {
+                if (image->available(position)) {
+                    print(position);
+                }
+                });
+        }
+        else if (command == "STATUS" && words.size() == 1) {
+            const catalogimage::Header& info = image->info();
+            out << "- generation " << info.generation << ", published " << formatDate(info.publishedAt) << ", "
+                << info.bookCount << " books (" << info.availableCount << " available), " << info.titleCount << " titles, "
+                << info.authorCount << " authors\n"
+                << "- mapped " << fixed << setprecision(1) << image->mappedBytes() / (1024.0 * 1024.0) << " MB shared, "
+                << privateRssKb() / 1024.0 << " MB private\n";
+        }
+        else {
+            out << "error: unknown command or wrong number of arguments\n";
+            continue;
+        }
+        out << "ok\n";
+        out.flush();
+    }
+    return 0;
+}
 
-    // Function to add a patron
-    void addPatron() {
-        string firstName, lastName;
-        cout << "Enter first name of the patron to add: ";
-        getline(cin, firstName);
-        if (hasWhitespace(firstName)) {
-            return; 
+#ifndef _WIN32
+// Function to serve one desk connected to the socket. Every command is answered with its
+// results followed by "ok" or "error: <message>"; QUIT ends the session and SHUTDOWN also
+// stops the server. Returns true for SHUTDOWN
+template<typename LibraryType>
+bool runSession(LibraryType& library, int client) {
+    FdStreamBuf buffer(client);
+    istream in(&buffer);
+    ostream out(&buffer);
+    string line;
+    vector<string> words;
+    while (getline(in, line)) {
+        if (!splitCommand(line, words)) {
+            out << "error: unterminated quote\n";
         }
-        cout << "Enter last name of the patron to add: ";
-        getline(cin, lastName);
-        if (hasWhitespace(lastName)) {
-            return; // Abort adding patron
+        else if (words.size() == 1 && (words[0] == "QUIT" || words[0] == "SHUTDOWN")) {
+            out << "ok\n";
+            out.flush();
+            return words[0] == "SHUTDOWN";
+        }
+        else if (!words.empty() && words[0][0] != '#') {
+            OpStatus status;
+            if (!runCommand(library, words, out, status)) {
+                out << "error: unknown command or wrong number of arguments\n";
+            }
+            else if (status != OpStatus::Ok) {
+                out << "error: " << statusMessage(status) << "\n";
+            }
+            else {
+                out << "ok\n";
+            }
+        }
+        // Pipelined commands are answered together once the input read so far is used up
+        if (in.rdbuf()->in_avail() == 0) {
+            out.flush();
         }
-        patrons.push_back(Patron(firstName, lastName));
-        cout << "\nPatron added: " << firstName << " " << lastName << "\n";
     }
+    return false;
+}
 
-    // Function to remove a patron
-    void removePatron() {
-        string firstName, lastName;
-        cout << "Enter first name of the patron to remove: ";
-        getline(cin, firstName);
-        if (hasWhitespace(firstName)) {
-            return;
+// Function to let several desks share one library over a local Unix socket. Each connection
+// runs in its own thread and the journal is group committed every 10 ms for all of them. A
+// catalog image, if one is set, is republished by a thread of its own
+int runServer(BerryLibrary& library, const string& socketPath) {
+    signal(SIGPIPE, SIG_IGN);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        cerr << "Socket path is too long.\n";
+        return 1;
+    }
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    unlink(socketPath.c_str());
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        cerr << "Unable to listen on " << socketPath << ".\n";
+        if (listener >= 0) {
+            close(listener);
         }
-        cout << "Enter last name of the patron to remove: ";
-        getline(cin, lastName);
-        if (hasWhitespace(lastName)) {
-            return;
+        return 1;
+    }
+
+    atomic<bool> running{ true };
+    thread committer([&library, &running] {
+        while (running.load()) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+            library.commitJournal();
+            library.dumpStatsIfDue();
+        }
+        });
+    // Publishing a large catalog takes longer than a commit interval, so it has its own thread
+    thread publisher([&library, &running] {
+        while (running.load()) {
+            library.publishImageIfDue();
+            this_thread::sleep_for(chrono::milliseconds(100));
+        }
+        });
+
+    struct Session {
+        int client;
+        thread worker;
+        atomic<bool> finished{ false };
+    };
+    vector<unique_ptr<Session>> sessions;
+    cout << "Serving the library on " << socketPath << "\n";
+    while (running.load()) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+        // Finished sessions are joined as new desks connect
+        for (auto it = sessions.begin(); it != sessions.end();) {
+            if ((*it)->finished.load()) {
+                (*it)->worker.join();
+                close((*it)->client);
+                it = sessions.erase(it);
+            }
+            else {
+                ++it;
+            }
         }
+        sessions.push_back(make_unique<Session>());
+        Session& session = *sessions.back();
+        session.client = client;
+        session.worker = thread([&library, &running, &session, listener] {
+            bool stopServer = runSession(library, session.client);
+            // The desk sees the end of the session now, the descriptor is closed when the session is joined
+            shutdown(session.client, SHUT_RDWR);
+            if (stopServer) {
+                running = false;
+                shutdown(listener, SHUT_RDWR);
+            }
+            session.finished = true;
+            });
+    }
 
-        auto it = find_if(patrons.begin(), patrons.end(), [&firstName, &lastName](const Patron& patron) {
-            return patron.getFirstName() == firstName && patron.getLastName() == lastName;
+    running = false;
+    for (auto& session : sessions) {
+        shutdown(session->client, SHUT_RDWR);
+    }
+    for (auto& session : sessions) {
+        session->worker.join();
+        close(session->client);
+    }
+    committer.join();
+    publisher.join();
+    library.commitJournal();
+    close(listener);
+    unlink(socketPath.c_str());
+    cout << "Server stopped.\n";
+    return 0;
+}
+#endif
+
+// Function to check that concurrent desks can share one library. First every thread races to
+// check out the same books, each of which must go to exactly one desk. Then 1, 2, 4 ... threads
+// run a mix of 90% searches and 10% checkout and return pairs, and the throughput is reported
+template<typename LibraryType>
+int runStress(size_t bookCount, double secondsPerRun) {
+    const size_t patronCount = 256;
+    CatalogGenerator generator;
+    LibraryType library;
+    vector<string> titles;
+    titles.reserve(bookCount);
+    for (size_t i = 0; i < bookCount; i++) {
+        titles.push_back(generator.title(i));
+        size_t author = generator.below(bookCount);
+        library.insertBook(titles.back(), generator.authorFirst(author) + " " + generator.authorLast(author));
+    }
+    for (size_t i = 0; i < patronCount; i++) {
+        library.insertPatron(generator.patronFirst(i), generator.patronLast(i));
+    }
+    size_t hardwareThreads = max(1u, thread::hardware_concurrency());
+    size_t maxThreads = max<size_t>(4, hardwareThreads * 2);
+    cout << "Stress test: " << bookCount << " books, " << patronCount << " patrons, " << hardwareThreads << " hardware threads\n";
+
+    // Race: every desk tries to check out every contested book
+    size_t contested = min<size_t>(1000, bookCount);
+    atomic<size_t> won{ 0 };
+    vector<thread> desks;
+    for (size_t t = 0; t < maxThreads; t++) {
+        desks.emplace_back([&, t] {
+            for (size_t i = 0; i < contested; i++) {
+                if (library.checkOut(generator.patronFirst(t), generator.patronLast(t), titles[i]) == OpStatus::Ok) {
+                    won++;
+                }
+            }
+            });
+    }
+    for (thread& desk : desks) {
+        desk.join();
+    }
+    bool raceOk = won.load() == contested && library.loanCount() == contested;
+    cout << "Checkout race: " << maxThreads << " desks, " << contested << " books, " << won.load() << " checkouts won, "
+        << library.loanCount() << " loans -> " << (raceOk ? "ok" : "FAILED") << "\n";
+    desks.clear();
+    for (size_t t = 0; t < maxThreads; t++) {
+        desks.emplace_back([&, t] {
+            for (size_t i = 0; i < contested; i++) {
+                library.checkIn(generator.patronFirst(t), generator.patronLast(t), titles[i]);
+            }
             });
-        if (it != patrons.end()) {
-            patrons.erase(it);
-            cout << "\nPatron removed: " << firstName << " " << lastName << "\n";
-        }else {
-            cout << "\nPatron not found.\n";
-        }
+    }
+    for (thread& desk : desks) {
+        desk.join();
     }
 
-    // Function to display books checked out by a patron
-    void displayBooksCheckedOutByPatron() {
-        string firstName, lastName;
-        cout << "Enter patron first name: ";
-        cin >> firstName;
-        cout << "Enter patron last name: ";
-        cin >> lastName;
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        bool found = false;
-        for (const Patron& patron : patrons) {
-            if (lower(patron.getFirstName()) == lower(firstName) && lower(patron.getLastName()) == lower(lastName)) {
-                found = true;
-                const vector<Book*>& checkedOutBooks = patron.getCheckedOutBooks();
-                if (!checkedOutBooks.empty()) {
-                    cout << "\nBooks checked out by " << firstName << " " << lastName << ":\n";
-                    for (const Book* book : checkedOutBooks) {
-                        cout << "- " << book->title << " by " << book->author << "\n";
+    cout << "\n" << left << setw(10) << "threads" << right << setw(14) << "ops/sec" << setw(14) << "loans/sec" << setw(10) << "scaling" << "\n";
+    double baseline = 0;
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        atomic<bool> stop{ false };
+        atomic<size_t> totalOps{ 0 }, totalLoans{ 0 };
+        desks.clear();
+        for (size_t t = 0; t < threads; t++) {
+            desks.emplace_back([&, t] {
+                CatalogGenerator local(t + 1);
+                size_t ops = 0, loansDone = 0;
+                size_t patron = t % patronCount;
+                while (!stop.load(memory_order_relaxed)) {
+                    const string& title = titles[local.below(bookCount)];
+                    size_t kind = local.below(10);
+                    if (kind == 0) {
+                        if (library.checkOut(generator.patronFirst(patron), generator.patronLast(patron), title) == OpStatus::Ok) {
+                            library.checkIn(generator.patronFirst(patron), generator.patronLast(patron), title);
+                            loansDone++;
+                        }
+                        ops += 2;
+                        continue;
+                    }
+                    if (kind < 5) {
+                        library.withTitle(title, [](const Book&) {});
                     }
-                }else {
-                    cout << "\nNo books checked out by " << firstName << " " << lastName << "\n";
+                    else if (kind < 8) {
+                        library.searchCatalog(title.substr(title.size() - 12), 10, [](const Book&, const SearchHit&) {});
+                    }
+                    else {
+                        size_t author = local.below(bookCount);
+                        library.forEachBookByAuthor(generator.authorFirst(author) + " " + generator.authorLast(author), [](const Book&) {});
+                    }
+                    ops++;
                 }
-                break;
-            }
+                totalOps += ops;
+                totalLoans += loansDone;
+                });
         }
-        if (!found) {
-            cout << "\nPatron not found.\n";
+        this_thread::sleep_for(chrono::duration<double>(secondsPerRun));
+        stop = true;
+        for (thread& desk : desks) {
+            desk.join();
         }
+        double opsPerSecond = totalOps.load() / secondsPerRun;
+        if (threads == 1) {
+            baseline = opsPerSecond;
+        }
+        cout << left << setw(10) << threads << right << setw(14) << static_cast<uint64_t>(opsPerSecond)
+            << setw(14) << static_cast<uint64_t>(totalLoans.load() / secondsPerRun)
+            << setw(9) << fixed << setprecision(2) << (baseline > 0 ? opsPerSecond / baseline : 0) << "x\n";
     }
+    return raceOk ? 0 : 1;
+}
 
-    // Function to print all patrons
-    void printAllPatrons() {
-        cout << "\nList of Patrons:\n";
-        for (const Patron& patron : patrons) {
-            cout << "- " << patron.getFirstName() << " " << patron.getLastName() << "\n";
+int main(int argc, char* argv[]) {
+    // Convert a JSON catalog into a binary snapshot: BerryManagementSys --convert books.json library.snap
+    if (argc == 4 && string(argv[1]) == "--convert") {
+        BerryLibrary converter;
+        if (!converter.readFromFile(argv[2]) || !converter.writeSnapshot(argv[3])) {
+            return 1;
         }
+        cout << "Snapshot written to " << argv[3] << "\n";
+        return 0;
     }
 
-    // Function to write books to a JSON file
-    void writeToLogFile() {
-        ofstream outFile("booksLogTo.json");
-        if (outFile.is_open()) {
-            json jsonData = json::array();
-            for (const Book& book : books) {
-                jsonData.push_back({
-                    {"Author", book.author},
-                    {"Title", book.title},
-                    {"CheckedOut", book.checkedOut}
-                    });
-            }
-            outFile << jsonData.dump(4);
-            outFile.close();
-            cout << "\nBooks written to file.\n\n";
+    // Benchmark generated catalogs: BerryManagementSys --bench [book counts...], 10^3 to 10^6 books by default
+    if (argc >= 2 && string(argv[1]) == "--bench") {
+        vector<size_t> bookCounts;
+        for (int i = 2; i < argc; i++) {
+            bookCounts.push_back(stoull(argv[i]));
         }
-        else {
-            cerr << "Unable to open file for writing.\n";
+        if (bookCounts.empty()) {
+            bookCounts = { 1000, 10000, 100000, 1000000 };
         }
+        return runBenchmarks<BerryLibrary>(bookCounts, "berry_bench.json");
     }
 
-    // Function to read books from a JSON file
-    void readFromFile() {
-        ifstream inFile("books.json");
-        try {
-            json jsonData;
-            inFile >> jsonData;
-            inFile.close();
+    // Compare the book store policies: BerryManagementSys --compare-stores [books] [seconds per workload]
+    if (argc >= 2 && string(argv[1]) == "--compare-stores") {
+        size_t bookCount = argc >= 3 ? stoull(argv[2]) : 100000;
+        double seconds = argc >= 4 ? stod(argv[3]) : 1.0;
+        return compareStores(bookCount, seconds);
+    }
 
-            for (const auto& bookData : jsonData) {
-                string title = bookData["Title"];
-                string author = bookData["Author"];
-                bool checkedOut = bookData["CheckedOut"];
-                books.push_back(Book{ title, author, checkedOut });
-            }
-            cout << "\n-Books read from file.\n\n";
-        }
-        catch (const exception& e) {
-            cerr << "An error occurred while reading from file: " << e.what() << endl;
-        }
+    // Time the circulation reports: BerryManagementSys --history-bench [events], 20 million by default
+    if (argc >= 2 && string(argv[1]) == "--history-bench") {
+        return runHistoryBench(argc >= 3 ? stoull(argv[2]) : 20000000);
     }
 
-    void addPatronsForTesting(string first, string last) {
-        patrons.push_back(Patron(first, last));
-    }
-
-    void checkOutBookForTestPatrons(string first,string last,string title) {
-        bool patronFound = false;
-        for (Patron& patron : patrons) {
-            if (lower(patron.getFirstName()) == lower(first) && lower(patron.getLastName()) == lower(last)) {
-                patronFound = true;
-                for (Book& book : books) {
-                    if (lower(book.title) == lower(title)) {
-                        if (!book.checkedOut) {
-                            book.checkedOut = true;
-                            patron.checkOutBook(&book);
-                            return;
-                        }else {return; }
-                    }
-                }
-                return;
-            }
+    // Measure concurrent desks on a generated catalog: BerryManagementSys --stress [books] [seconds per run]
+    if (argc >= 2 && string(argv[1]) == "--stress") {
+        size_t bookCount = argc >= 3 ? stoull(argv[2]) : 100000;
+        double seconds = argc >= 4 ? stod(argv[3]) : 2.0;
+        return runStress<BerryLibrary>(bookCount, seconds);
+    }
+
+    // Publish a JSON catalog as a catalog image once: BerryManagementSys --publish books.json catalog.img
+    if (argc == 4 && string(argv[1]) == "--publish") {
+        BerryLibrary publisher;
+        if (!publisher.readFromFile(argv[2]) || !publisher.publishCatalogImage(argv[3])) {
+            return 1;
         }
+        cout << "Catalog image written to " << argv[3] << "\n";
+        return 0;
     }
 
-};
+    // Answer catalog queries from stdin out of a published image: BerryManagementSys --replica catalog.img
+    if (argc == 3 && string(argv[1]) == "--replica") {
+        ios::sync_with_stdio(false);
+        return runReplica(argv[2], cin, cout);
+    }
+
+    // Share one library between desks over a local socket, and keep a catalog image published
+    // for replicas if one is named: BerryManagementSys --serve [berry.sock] [catalog.img]
+    if (argc >= 2 && string(argv[1]) == "--serve") {
+#ifndef _WIN32
+        BerryLibrary library;
+        library.openAuditLog();
+        startLibrary(library);
+        library.startOverdueNotices();
+        if (argc >= 4) {
+            library.setCatalogImage(argv[3]);
+        }
+        return runServer(library, argc >= 3 ? argv[2] : "berry.sock");
+#else
+        cerr << "Serving over a local socket is not supported on this platform.\n";
+        return 1;
+#endif
+    }
 
+    // Apply a command file without prompts: BerryManagementSys --batch commands.txt (or - for stdin)
+    if (argc == 3 && string(argv[1]) == "--batch") {
+        ios::sync_with_stdio(false);
+        BerryLibrary library;
+        library.openAuditLog();
+        startLibrary(library);
+        library.startOverdueNotices();
+        string fileName = argv[2];
+        if (fileName == "-") {
+            return runBatch(library, cin, cout) == 0 ? 0 : 1;
+        }
+        ifstream commandFile(fileName);
+        if (!commandFile.is_open()) {
+            cerr << "Unable to open command file " << fileName << ".\n";
+            return 1;
+        }
+        return runBatch(library, commandFile, cout) == 0 ? 0 : 1;
+    }
 
-int main() {
-    Library<vector<Book>, vector<Patron>, vector<Person>> library;
+    auto launched = chrono::steady_clock::now();
+    BerryLibrary library;
     string firstName, lastName;
 
+    // Rebuild the library from the journal, only a fresh start loads the file and the test data.
+    // This runs in the background while the librarian signs in and the first commands are given
+    library.openAuditLog();
+    thread loader = startLibraryInBackground(library);
+
     // Welcome message
     cout << right << setw(57) << setfill('*') << "*\n";
     cout << right << setw(57) << setfill('*') << "*\n";
@@ -485,40 +3845,26 @@ int main() {
     cout << "\n" << right << setw(58) << setfill('*') << "*\n\n";
 
     // Prompt user to enter their name
+    auto promptWork = chrono::steady_clock::now() - launched;
     cout << "Enter your first name: ";
     cin >> firstName;
     cout << "Enter your last name: ";
     cin >> lastName;
     cin.ignore();
+    auto signedIn = chrono::steady_clock::now();
     // Log user(librarian) with date
     library.logUserName(firstName, lastName);
 
-    //For submission only, normally called by case 'R' and user types file to read from
-    library.readFromFile();
-
-
-    /*For submission only, Added this while double checking the rubric before submission bc I noticed the comment not to make you add any files,
-    I assumed that meant test data too. I had planned for the user(librarian) to add patrons and for none to exist until the librarian added them.
-    I added these test users so all the functions are usable immediately after compiling the program.
-    The ones effected by this if I didnt add the test data were checkout book, return book, view all patrons, search patron and then view all books checked out to that patron.
-    */
-    library.addPatronsForTesting("Sarah", "Lee");
-    library.addPatronsForTesting("Sam", "Dunfey");
-    library.addPatronsForTesting("James", "Jones");
-    library.addPatronsForTesting("Candace", "Baker");
-    library.checkOutBookForTestPatrons("Sarah", "Lee", "Python Programming");
-    library.checkOutBookForTestPatrons("Sam", "Dunfey", "Web Development Crash Course");
-    library.checkOutBookForTestPatrons("James", "Jones", "The Art of Programming VOL2");
-    library.checkOutBookForTestPatrons("James", "Jones", "Blockchain Technology Explained");
-    library.checkOutBookForTestPatrons("Candace", "Baker", "Artificial Intelligence Basics");
-    //One more note, the books.json does not have any books checked out.
-    //If you trigger the writeToLogFile function with case W, they will appear checked out.
-
 
     string input;
     char choice = 0;
+    bool firstPrompt = true;
     while (choice != 'X') {
         cout << "\nPress L to print List of Commands:\n";
+        if (firstPrompt) {
+            library.recordFirstPrompt(promptWork + (chrono::steady_clock::now() - signedIn));
+            firstPrompt = false;
+        }
         cout << "Command: ";
         getline(cin, input);
 
@@ -528,6 +3874,22 @@ int main() {
         }
         // Convert input to uppercase
         choice = toupper(input[0]);
+        library.countCommand(choice);
+
+        // While the catalog loads, lookups are answered from the books loaded so far and every
+        // other command waits for the load to finish
+        if (choice != 'L' && choice != 0 && library.currentLoadStage() != LoadStage::Ready) {
+            if (string_view("ABFQOPTG").find(choice) != string_view::npos) {
+                library.waitForLoad(LoadStage::ReadingFile);
+                if (library.currentLoadStage() != LoadStage::Ready) {
+                    cout << "\n-Catalog still loading (" << library.loadStatus() << "), results may be incomplete.\n";
+                }
+            }
+            else {
+                cout << "\n-Waiting for the catalog to load (" << library.loadStatus() << ")...\n";
+                library.waitForLoad();
+            }
+        }
 
         // Switch case for different commands
         switch (choice) {
@@ -535,12 +3897,15 @@ int main() {
             cout << "\nList of Commands:\n";
             cout << "Press A to search for books by author\n";
             cout << "Press B to search for a specific book title\n";
+            cout << "Press F to find books by part of a title or author\n";
             cout << "Press I to add a new book\n";
             cout << "Press M to remove a books\n";
             cout << "Press C to check out a book\n";
             cout << "Press U to return a book\n";
+            cout << "Press O to list overdue books\n";
             cout << "Press S to sort books by title or author\n";
-            cout << "Press V to print a list of all books\n\n";
+            cout << "Press V to print a list of all books\n";
+            cout << "Press Q to list available books\n\n";
 
             cout << "Press P to search for a patron and display their checked out books\n";
             cout << "Press N to add new patron\n";
@@ -548,7 +3913,10 @@ int main() {
             cout << "Press D to delete a patron\n\n";
 
             cout << "Press R to read books from file\n";
+            cout << "Press J to import JSON files or directories of them\n";
             cout << "Press W to write books to file\n";
+            cout << "Press H to show circulation history reports\n";
+            cout << "Press G to show library statistics\n";
             cout << "Press X to exit program\n";
             break;
         }
@@ -565,6 +3933,10 @@ int main() {
             library.searchBookByTitle();
             break;
         }
+        case 'F': {
+            library.findBooks();
+            break;
+        }
 
         case 'I': {
             library.addBook();
@@ -582,6 +3954,10 @@ int main() {
             library.returnBook();
             break;
         }
+        case 'O': {
+            library.printOverdueBooks();
+            break;
+        }
         case 'S': {
             library.promptSortBy();
             library.printAllBooks();
@@ -591,6 +3967,10 @@ int main() {
             library.printAllBooks();
             break;
         }
+        case 'Q': {
+            library.printAvailableBooks();
+            break;
+        }
 
 
         case 'P': {       
@@ -617,10 +3997,22 @@ int main() {
             library.readFromFile();
             break;
         }
+        case 'J': {
+            library.importBooks();
+            break;
+        }
         case 'W': {
             library.writeToLogFile();
             break;
         }
+        case 'H': {
+            library.printCirculationReport();
+            break;
+        }
+        case 'G': {
+            library.printStats();
+            break;
+        }
         case 'X': {
             cout << "\nExiting program...\n\n";
             break;
@@ -634,5 +4026,10 @@ int main() {
             break;
         }
         }
+        if (library.currentLoadStage() == LoadStage::Ready) {
+            library.commitJournal();
+            library.dumpStatsIfDue();
+        }
     }
+    loader.join();
 }
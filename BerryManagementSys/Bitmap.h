@@ -0,0 +1,68 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Dense bitmap over small integer IDs such as book IDs, one bit per ID in 64-bit words. Counts
+// and combinations run a word at a time with std::popcount, which compiles to the popcount
+// instruction, over plain loops the compiler can vectorize. IDs past the end read as clear.
+class Bitmap {
+private:
+    std::vector<uint64_t> words;
+
+    static uint64_t bit(uint32_t id) { return uint64_t(1) << (id & 63); }
+    uint64_t word(size_t i) const { return i < words.size() ? words[i] : 0; }
+
+public:
+    bool test(uint32_t id) const { return (word(id >> 6) & bit(id)) != 0; }
+
+    void assign(uint32_t id, bool value) {
+        size_t i = id >> 6;
+        if (i >= words.size()) {
+            if (!value) {
+                return;
+            }
+            words.resize(i + 1, 0);
+        }
+        words[i] = value ? words[i] | bit(id) : words[i] & ~bit(id);
+    }
+
+    // Function to reserve room for IDs below count
+    void reserve(size_t count) { words.reserve((count + 63) / 64); }
+    size_t memoryBytes() const { return words.capacity() * sizeof(uint64_t); }
+
+    // Function to count the set IDs
+    size_t count() const {
+        size_t total = 0;
+        for (uint64_t w : words) {
+            total += static_cast<size_t>(std::popcount(w));
+        }
+        return total;
+    }
+
+    // Function to count the IDs set here and clear in other
+    size_t countAndNot(const Bitmap& other) const {
+        size_t shared = std::min(words.size(), other.words.size()), total = 0;
+        for (size_t i = 0; i < shared; i++) {
+            total += static_cast<size_t>(std::popcount(words[i] & ~other.words[i]));
+        }
+        for (size_t i = shared; i < words.size(); i++) {
+            total += static_cast<size_t>(std::popcount(words[i]));
+        }
+        return total;
+    }
+
+    // Function to call onId(id) for every ID set here and clear in other, in ascending order
+    template<typename OnId>
+    void forEachAndNot(const Bitmap& other, OnId onId) const {
+        for (size_t i = 0; i < words.size(); i++) {
+            uint64_t w = words[i] & ~other.word(i);
+            while (w != 0) {
+                onId(static_cast<uint32_t>(i * 64 + static_cast<size_t>(std::countr_zero(w))));
+                w &= w - 1;
+            }
+        }
+    }
+};
@@ -0,0 +1,394 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "MappedFile.h"
+#include "Snapshot.h"
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+// On-disk layout of a catalog image, the read-only catalog a primary publishes for query
+// replicas:
+//
+//   Header | Book[bookCount] | Posting[titleCount] | Posting[authorCount] | uint32 members[2 * bookCount]
+//          | uint32 titleSlots[titleSlotCount] | uint32 authorSlots[authorSlotCount]
+//          | uint64 available[availableWords] | string bytes
+//
+// A title or author posting is a run of book positions in members. The slot tables are open
+// addressing hash tables over the case-folded keys, a slot holds a posting number plus one and
+// 0 marks an empty slot. Bit i of available is set when book i is on the shelf. Every table is
+// aligned to its records, so a replica maps the file and reads it in place. An image never changes once
+// published: the primary writes the next generation to a temporary file and renames it over
+// the old one, and replicas notice the new file and map it while queries finish on the old.
+namespace catalogimage {
+
+const char magic[8] = { 'B', 'E', 'R', 'R', 'Y', 'I', 'M', 'G' };
+const uint32_t version = 1;
+
+using StringRef = snapshot::StringRef;
+using Book = snapshot::Book;
+
+struct Posting {
+    uint32_t first;
+    uint32_t count;
+};
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t generation;
+    int64_t publishedAt;
+    uint64_t bookCount;
+    uint64_t availableCount;
+    uint64_t titleCount;
+    uint64_t authorCount;
+    uint64_t titleSlotCount;
+    uint64_t authorSlotCount;
+    uint64_t booksOffset;
+    uint64_t titlesOffset;
+    uint64_t authorsOffset;
+    uint64_t membersOffset;
+    uint64_t titleSlotsOffset;
+    uint64_t authorSlotsOffset;
+    uint64_t availableOffset;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+};
+
+// Case-folded FNV-1a, the hash of the slot tables. Writer and readers must agree on it, so it
+// is part of the format rather than borrowed from the library's indexes
+inline uint64_t hashKey(std::string_view key) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : key) {
+        hash ^= static_cast<unsigned char>(std::tolower(static_cast<unsigned char>(c)));
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline bool sameKey(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+        return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+        });
+}
+
+inline uint64_t align8(uint64_t offset) { return (offset + 7) & ~uint64_t(7); }
+
+// Collects the books of a catalog and writes them as an image. Books whose titles (or authors)
+// match ignoring case must pass the same titleKey (authorKey) view, as the library's pooled
+// keys are, so the postings are found by sorting on the key address rather than by comparing
+// strings. The strings are only read by write() and must outlive it
+class Builder {
+private:
+    struct Entry {
+        std::string_view title, author, titleKey, authorKey;
+        bool checkedOut;
+    };
+    std::vector<Entry> entries;
+
+    // Function to group the books by one key into postings and member positions, and fill a
+    // slot table of twice as many slots as postings, rounded up to a power of two
+    template<typename KeyOf>
+    void group(KeyOf keyOf, std::vector<Posting>& postings, std::vector<uint32_t>& members, std::vector<uint32_t>& slots) const {
+        std::vector<std::pair<const char*, uint32_t>> order;
+        order.reserve(entries.size());
+        for (uint32_t i = 0; i < entries.size(); i++) {
+            order.push_back({ keyOf(entries[i]).data(), i });
+        }
+        std::sort(order.begin(), order.end());
+        std::vector<uint32_t> keys;
+        for (size_t i = 0; i < order.size(); i++) {
+            if (i == 0 || order[i].first != order[i - 1].first) {
+                postings.push_back({ static_cast<uint32_t>(members.size()), 0 });
+                keys.push_back(order[i].second);
+            }
+            members.push_back(order[i].second);
+            postings.back().count++;
+        }
+        slots.assign(std::bit_ceil(std::max<size_t>(2 * postings.size(), 1)), 0);
+        uint64_t mask = slots.size() - 1;
+        for (uint32_t p = 0; p < postings.size(); p++) {
+            uint64_t at = hashKey(keyOf(entries[keys[p]])) & mask;
+            while (slots[at] != 0) {
+                at = (at + 1) & mask;
+            }
+            slots[at] = p + 1;
+        }
+    }
+
+public:
+    void reserve(size_t count) { entries.reserve(count); }
+
+    void addBook(std::string_view title, std::string_view author, std::string_view titleKey, std::string_view authorKey, bool checkedOut) {
+        entries.push_back({ title, author, titleKey, authorKey, checkedOut });
+    }
+
+    // Function to write the image of the collected books as the given generation. Returns false
+    // if the file could not be written, the previous image is then left in place
+    bool write(const std::string& fileName, uint64_t generation, int64_t publishedAt) const {
+        std::vector<Posting> titles, authors;
+        std::vector<uint32_t> members, titleSlots, authorSlots;
+        members.reserve(2 * entries.size());
+        group([](const Entry& entry) { return entry.titleKey; }, titles, members, titleSlots);
+        group([](const Entry& entry) { return entry.authorKey; }, authors, members, authorSlots);
+        std::vector<uint64_t> available((entries.size() + 63) / 64, 0);
+
+        Header header{};
+        std::memcpy(header.magic, magic, sizeof(header.magic));
+        header.version = version;
+        header.headerSize = sizeof(Header);
+        header.generation = generation;
+        header.publishedAt = publishedAt;
+        header.bookCount = entries.size();
+        header.titleCount = titles.size();
+        header.authorCount = authors.size();
+        header.titleSlotCount = titleSlots.size();
+        header.authorSlotCount = authorSlots.size();
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (!entries[i].checkedOut) {
+                available[i >> 6] |= uint64_t(1) << (i & 63);
+                header.availableCount++;
+            }
+            header.stringsSize += entries[i].title.size() + entries[i].author.size();
+        }
+        header.booksOffset = sizeof(Header);
+        header.titlesOffset = header.booksOffset + header.bookCount * sizeof(Book);
+        header.authorsOffset = header.titlesOffset + header.titleCount * sizeof(Posting);
+        header.membersOffset = header.authorsOffset + header.authorCount * sizeof(Posting);
+        header.titleSlotsOffset = header.membersOffset + members.size() * sizeof(uint32_t);
+        header.authorSlotsOffset = header.titleSlotsOffset + titleSlots.size() * sizeof(uint32_t);
+        header.availableOffset = align8(header.authorSlotsOffset + authorSlots.size() * sizeof(uint32_t));
+        header.stringsOffset = header.availableOffset + available.size() * sizeof(uint64_t);
+
+        // The image is derived from the journaled library and is rebuilt on the next publish, so
+        // it is not flushed to disk before the rename
+        snapshot::Writer writer(fileName, false);
+        writer.write(header);
+        uint64_t nextString = 0;
+        for (const Entry& entry : entries) {
+            StringRef title{ nextString, entry.title.size() };
+            StringRef author{ title.offset + title.size, entry.author.size() };
+            nextString = author.offset + author.size;
+            writer.write(Book{ title, author, entry.checkedOut ? 1u : 0u });
+        }
+        writer.write(titles.data(), titles.size() * sizeof(Posting));
+        writer.write(authors.data(), authors.size() * sizeof(Posting));
+        writer.write(members.data(), members.size() * sizeof(uint32_t));
+        writer.write(titleSlots.data(), titleSlots.size() * sizeof(uint32_t));
+        writer.write(authorSlots.data(), authorSlots.size() * sizeof(uint32_t));
+        const char padding[8] = {};
+        writer.write(padding, header.availableOffset - (header.authorSlotsOffset + authorSlots.size() * sizeof(uint32_t)));
+        writer.write(available.data(), available.size() * sizeof(uint64_t));
+        for (const Entry& entry : entries) {
+            writer.write(entry.title.data(), entry.title.size());
+            writer.write(entry.author.data(), entry.author.size());
+        }
+        return writer.commit();
+    }
+};
+
+// Read-only view over a mapped image. open() validates the header and that every table lies
+// inside the file; postings, slots and string references are checked as they are followed, so
+// a damaged image answers nothing rather than reading outside the mapping
+class Reader {
+private:
+    MappedFile file;
+    const Header* header = nullptr;
+
+    bool inFile(uint64_t offset, uint64_t count, uint64_t size) const {
+        return offset <= file.size() && (count == 0 || (file.size() - offset) / count >= size);
+    }
+    template<typename T>
+    const T* table(uint64_t offset) const { return reinterpret_cast<const T*>(file.data() + offset); }
+
+    // Function to look up the posting of a key in one of the slot tables, or nullptr
+    const Posting* find(std::string_view key, const Posting* postings, uint64_t postingCount, const uint32_t* slots,
+        uint64_t slotCount, bool byTitle) const {
+        uint64_t mask = slotCount - 1;
+        uint64_t at = hashKey(key) & mask;
+        for (uint64_t probe = 0; probe < slotCount; probe++, at = (at + 1) & mask) {
+            uint32_t slot = slots[at];
+            if (slot == 0 || slot > postingCount) {
+                return nullptr;
+            }
+            const Posting& posting = postings[slot - 1];
+            if (posting.count == 0 || posting.first >= 2 * header->bookCount || posting.count > 2 * header->bookCount - posting.first) {
+                return nullptr;
+            }
+            uint32_t book = members()[posting.first];
+            if (book < header->bookCount) {
+                const Book& record = books()[book];
+                if (sameKey(str(byTitle ? record.title : record.author), key)) {
+                    return &posting;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    template<typename OnBook>
+    void forEach(const Posting* posting, OnBook onBook) const {
+        if (!posting) {
+            return;
+        }
+        for (uint32_t i = 0; i < posting->count; i++) {
+            uint32_t book = table<uint32_t>(header->membersOffset)[posting->first + i];
+            if (book < header->bookCount) {
+                onBook(book);
+            }
+        }
+    }
+
+public:
+    std::string error;
+
+    Reader() = default;
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    bool open(const std::string& fileName) {
+        if (!file.open(fileName, false)) {
+            error = "unable to open " + fileName;
+            return false;
+        }
+        if (file.size() < sizeof(Header)) {
+            error = "file is too small to be a catalog image";
+            return false;
+        }
+        header = table<Header>(0);
+        if (std::memcmp(header->magic, magic, sizeof(magic)) != 0) {
+            error = "not a catalog image";
+            return false;
+        }
+        if (header->version != version || header->headerSize != sizeof(Header)) {
+            error = "unsupported catalog image version " + std::to_string(header->version);
+            return false;
+        }
+        if (header->bookCount >= (uint64_t(1) << 31) || !std::has_single_bit(header->titleSlotCount)
+            || !std::has_single_bit(header->authorSlotCount)
+            || !inFile(header->booksOffset, header->bookCount, sizeof(Book))
+            || !inFile(header->titlesOffset, header->titleCount, sizeof(Posting))
+            || !inFile(header->authorsOffset, header->authorCount, sizeof(Posting))
+            || !inFile(header->membersOffset, 2 * header->bookCount, sizeof(uint32_t))
+            || !inFile(header->titleSlotsOffset, header->titleSlotCount, sizeof(uint32_t))
+            || !inFile(header->authorSlotsOffset, header->authorSlotCount, sizeof(uint32_t))
+            || !inFile(header->availableOffset, (header->bookCount + 63) / 64, sizeof(uint64_t))
+            || !inFile(header->stringsOffset, header->stringsSize, 1)) {
+            error = "catalog image is truncated";
+            return false;
+        }
+        return true;
+    }
+
+    const Header& info() const { return *header; }
+    size_t mappedBytes() const { return file.size(); }
+    const Book* books() const { return table<Book>(header->booksOffset); }
+    const uint32_t* members() const { return table<uint32_t>(header->membersOffset); }
+
+    bool available(uint64_t book) const {
+        return book < header->bookCount && (table<uint64_t>(header->availableOffset)[book >> 6] >> (book & 63) & 1) != 0;
+    }
+
+    // Returns an empty string if the reference points outside the string blob
+    std::string_view str(const StringRef& ref) const {
+        if (ref.offset > header->stringsSize || ref.size > header->stringsSize - ref.offset) {
+            return {};
+        }
+        return std::string_view(file.data() + header->stringsOffset + ref.offset, static_cast<size_t>(ref.size));
+    }
+
+    // Function to call onBook(position) for each copy of a title, ignoring case
+    template<typename OnBook>
+    void forEachCopy(std::string_view title, OnBook onBook) const {
+        forEach(find(title, table<Posting>(header->titlesOffset), header->titleCount, table<uint32_t>(header->titleSlotsOffset),
+            header->titleSlotCount, true), onBook);
+    }
+
+    // Function to call onBook(position) for each book of an author, ignoring case
+    template<typename OnBook>
+    void forEachBookByAuthor(std::string_view author, OnBook onBook) const {
+        forEach(find(author, table<Posting>(header->authorsOffset), header->authorCount, table<uint32_t>(header->authorSlotsOffset),
+            header->authorSlotCount, false), onBook);
+    }
+
+    // Function to call onBook(position) for each book on the shelf, a word of the bitmap at a time
+    template<typename OnBook>
+    void forEachAvailable(OnBook onBook) const {
+        const uint64_t* words = table<uint64_t>(header->availableOffset);
+        for (uint64_t i = 0; i < (header->bookCount + 63) / 64; i++) {
+            for (uint64_t word = words[i]; word != 0; word &= word - 1) {
+                uint64_t book = i * 64 + static_cast<uint64_t>(std::countr_zero(word));
+                if (book < header->bookCount) {
+                    onBook(book);
+                }
+            }
+        }
+    }
+
+};
+
+// A replica's handle on the published image. Queries take the current image with image() and
+// keep it to the end, so they see one generation throughout. refresh() maps a newly published
+// file and swaps it in; the image it replaces is unmapped when its last query lets go. Mapped
+// pages are shared with the primary and every other replica through the page cache, so an
+// extra replica costs its own few pages of heap and stack
+class Replica {
+private:
+    std::string fileName;
+    mutable std::mutex mutex;
+    std::shared_ptr<const Reader> current;
+    uint64_t device = 0, inode = 0;
+
+public:
+    std::string error;
+
+    explicit Replica(std::string imageFile) : fileName(std::move(imageFile)) {}
+
+    // Function to attach to the published image if it was replaced since the last call. Returns
+    // false if no image is attached, the old image stays attached when a new one is unreadable
+    bool refresh() {
+#ifndef _WIN32
+        struct stat info;
+        if (stat(fileName.c_str(), &info) != 0) {
+            error = "no catalog image at " + fileName;
+            return image() != nullptr;
+        }
+        if (image() && static_cast<uint64_t>(info.st_dev) == device && static_cast<uint64_t>(info.st_ino) == inode) {
+            return true;
+        }
+#else
+        if (image()) {
+            return true;
+        }
+#endif
+        auto next = std::make_shared<Reader>();
+        if (!next->open(fileName)) {
+            error = next->error;
+            return image() != nullptr;
+        }
+        std::lock_guard<std::mutex> guard(mutex);
+        current = std::move(next);
+#ifndef _WIN32
+        device = static_cast<uint64_t>(info.st_dev);
+        inode = static_cast<uint64_t>(info.st_ino);
+#endif
+        return true;
+    }
+
+    std::shared_ptr<const Reader> image() const {
+        std::lock_guard<std::mutex> guard(mutex);
+        return current;
+    }
+};
+
+}
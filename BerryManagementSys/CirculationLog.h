@@ -0,0 +1,509 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "MappedFile.h"
+
+// Kinds of circulation event, also the index of the per-bucket activity counters
+enum class CirculationEvent : uint8_t { CheckOut = 0, Return = 1 };
+
+// Append-only history of checkouts and returns, kept by column for analytics.
+//
+// Books and patrons are dictionary encoded: an event holds the 32-bit code of its title and
+// author pair and of its patron's name, so the history outlives the book IDs of one run and a
+// book's copies count as one title. Events sit in fixed chunks of four columns (book code,
+// patron code, seconds since timeEpoch, event type), 13 bytes per event. Chunks never move and
+// an event is never changed once written, so a query copies the chunk list under the mutex
+// and scans without it while desks keep appending. Times never decrease, so a time range is
+// found by binary search and the aggregations are tight loops over plain arrays.
+//
+// The history is saved to a file of blocks: dictionary entries as they are first used and
+// events column by column, appended by flush(). A block is applied on open only once it is
+// read whole, and a torn block at the end is cut off. A flush that fails to write is cut off
+// the file the same way and written again by the next flush.
+class CirculationLog {
+public:
+    // Times are stored as 32-bit seconds from 2020-01-01 UTC, good until 2156
+    static const int64_t timeEpoch = 1577836800;
+    static const size_t chunkSize = 1 << 16;
+
+    // A name with its event count, the result of the top-k queries
+    struct Ranked {
+        std::string name;
+        uint64_t count;
+    };
+
+private:
+    struct Chunk {
+        uint32_t book[chunkSize];
+        uint32_t patron[chunkSize];
+        uint32_t time[chunkSize];
+        uint8_t type[chunkSize];
+    };
+
+    // Chunks and event count as of one moment, the events below count never change
+    struct View {
+        std::vector<const Chunk*> chunks;
+        size_t count = 0;
+    };
+
+    enum BlockKind : uint32_t { BookBlock = 1, PatronBlock = 2, EventBlock = 3 };
+    static constexpr char magic[8] = { 'B', 'E', 'R', 'R', 'Y', 'C', 'I', 'R' };
+
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    size_t count = 0;
+    uint32_t lastTime = 0;
+
+    // Dictionaries. A book's author has its own code so loans can be summed per author
+    std::vector<std::pair<std::string, std::string>> books;
+    std::vector<uint32_t> bookAuthor;
+    std::vector<std::string> authors, patrons;
+    std::unordered_map<std::string, uint32_t> bookCodes, authorCodes, patronCodes;
+
+    // Persistence, flush() appends what was added since the last flush. savedBytes is the
+    // length of the file up to the last complete flush, guarded by fileMutex like the counts
+    std::mutex fileMutex;
+    std::string path;
+    FILE* file = nullptr;
+    size_t savedEvents = 0, savedBooks = 0, savedPatrons = 0;
+    uint64_t savedBytes = 0;
+
+    // Lookup key reused between events so a known book or patron costs no allocation
+    std::string scratch;
+
+    // Function to find the code of scratch, giving it the next code if it is new
+    static uint32_t codeOf(std::unordered_map<std::string, uint32_t>& codes, const std::string& key, size_t next) {
+        auto it = codes.find(key);
+        return it != codes.end() ? it->second : codes.emplace(key, static_cast<uint32_t>(next)).first->second;
+    }
+
+    // Function to add a title and author pair to the dictionary, the caller holds mutex
+    uint32_t lockedBookCode(std::string_view title, std::string_view author) {
+        scratch.assign(title).append(1, '\n').append(author);
+        uint32_t code = codeOf(bookCodes, scratch, books.size());
+        if (code == books.size()) {
+            scratch.assign(author);
+            uint32_t authorCode = codeOf(authorCodes, scratch, authors.size());
+            if (authorCode == authors.size()) {
+                authors.emplace_back(author);
+            }
+            books.emplace_back(std::string(title), std::string(author));
+            bookAuthor.push_back(authorCode);
+        }
+        return code;
+    }
+
+    // Function to add a patron's name to the dictionary, the caller holds mutex
+    uint32_t lockedPatronCode(std::string_view firstName, std::string_view lastName) {
+        scratch.assign(firstName);
+        if (!lastName.empty()) {
+            scratch.append(1, ' ').append(lastName);
+        }
+        uint32_t code = codeOf(patronCodes, scratch, patrons.size());
+        if (code == patrons.size()) {
+            patrons.push_back(scratch);
+        }
+        return code;
+    }
+
+    // Function to append one event, the caller holds mutex
+    void append(uint32_t book, uint32_t patron, uint32_t time, uint8_t type) {
+        if (count == chunks.size() * chunkSize) {
+            chunks.emplace_back(new Chunk);
+        }
+        Chunk& chunk = *chunks[count / chunkSize];
+        size_t i = count % chunkSize;
+        chunk.book[i] = book;
+        chunk.patron[i] = patron;
+        chunk.time[i] = time;
+        chunk.type[i] = type;
+        lastTime = time;
+        count++;
+    }
+
+    View view() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        View snapshot;
+        snapshot.chunks.reserve(chunks.size());
+        for (const auto& chunk : chunks) {
+            snapshot.chunks.push_back(chunk.get());
+        }
+        snapshot.count = count;
+        return snapshot;
+    }
+
+    // Function to convert a Unix time to the stored form, clamped to the representable range
+    static uint32_t storedTime(int64_t unixTime) {
+        return static_cast<uint32_t>(std::clamp<int64_t>(unixTime - timeEpoch, 0, UINT32_MAX));
+    }
+
+    // Function to find the first event at or after a stored time
+    static size_t firstAtOrAfter(const View& snapshot, uint32_t time) {
+        size_t low = 0, high = snapshot.count;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (snapshot.chunks[middle / chunkSize]->time[middle % chunkSize] < time) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        return low;
+    }
+
+    // Function to call kernel(chunk, begin, end) for the slices of the events in [from, to)
+    template<typename Kernel>
+    static void scan(const View& snapshot, int64_t from, int64_t to, Kernel kernel) {
+        size_t first = firstAtOrAfter(snapshot, storedTime(from));
+        size_t last = to <= from ? first : firstAtOrAfter(snapshot, storedTime(to));
+        while (first < last) {
+            size_t begin = first % chunkSize;
+            size_t end = std::min(chunkSize, begin + (last - first));
+            kernel(*snapshot.chunks[first / chunkSize], begin, end);
+            first += end - begin;
+        }
+    }
+
+    // Function to count the checkouts in [from, to) per code of one column
+    template<typename Column>
+    static std::vector<uint32_t> checkoutsPer(const View& snapshot, int64_t from, int64_t to, size_t codes, Column column) {
+        std::vector<uint32_t> counts(codes, 0);
+        scan(snapshot, from, to, [&counts, column](const Chunk& chunk, size_t begin, size_t end) {
+            const uint32_t* code = column(chunk);
+            const uint8_t* type = chunk.type;
+            uint32_t* out = counts.data();
+            // Branch free: a return adds zero
+            for (size_t i = begin; i < end; i++) {
+                out[code[i]] += type[i] == static_cast<uint8_t>(CirculationEvent::CheckOut);
+            }
+            });
+        return counts;
+    }
+
+    // Function to pick the k largest counts, ties broken by code; name(code) is called with mutex held
+    template<typename Name>
+    std::vector<Ranked> topK(const std::vector<uint32_t>& counts, size_t k, Name name) const {
+        std::vector<uint32_t> codes;
+        for (uint32_t code = 0; code < counts.size(); code++) {
+            if (counts[code] > 0) {
+                codes.push_back(code);
+            }
+        }
+        auto more = [&counts](uint32_t a, uint32_t b) { return counts[a] > counts[b] || (counts[a] == counts[b] && a < b); };
+        k = std::min(k, codes.size());
+        std::partial_sort(codes.begin(), codes.begin() + static_cast<std::ptrdiff_t>(k), codes.end(), more);
+        std::vector<Ranked> ranked;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < k; i++) {
+            ranked.push_back({ name(codes[i]), counts[codes[i]] });
+        }
+        return ranked;
+    }
+
+    size_t dictionarySize(const std::vector<std::string>& names) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return names.size();
+    }
+
+    // Function to load a history file, stopping at the first incomplete block. Returns the
+    // length of the valid part
+    size_t load(const std::string& fileName) {
+        MappedFile mapped;
+        if (!mapped.open(fileName) || mapped.size() < sizeof(magic) || std::memcmp(mapped.data(), magic, sizeof(magic)) != 0) {
+            return 0;
+        }
+        const char* data = mapped.data();
+        size_t size = mapped.size(), pos = sizeof(magic);
+        auto read32 = [&data, &pos]() {
+            uint32_t value;
+            std::memcpy(&value, data + pos, sizeof(value));
+            pos += sizeof(value);
+            return value;
+        };
+        std::vector<std::pair<std::string_view, std::string_view>> entryNames;
+        while (size - pos >= 8) {
+            size_t blockStart = pos;
+            uint32_t kind = read32(), entries = read32();
+            bool complete = true;
+            if (kind == BookBlock || kind == PatronBlock) {
+                // Entries are only given codes once the whole block is read, a torn block must
+                // not hand out codes that a later block on disk would hand out again
+                entryNames.clear();
+                for (uint32_t i = 0; i < entries && complete; i++) {
+                    if (size - pos < (kind == BookBlock ? 8u : 4u)) {
+                        complete = false;
+                        break;
+                    }
+                    uint32_t first = read32(), second = kind == BookBlock ? read32() : 0;
+                    if (size - pos < static_cast<size_t>(first) + second) {
+                        complete = false;
+                        break;
+                    }
+                    entryNames.emplace_back(std::string_view(data + pos, first), std::string_view(data + pos + first, second));
+                    pos += static_cast<size_t>(first) + second;
+                }
+                for (size_t i = 0; i < entryNames.size() && complete; i++) {
+                    if (kind == BookBlock) {
+                        lockedBookCode(entryNames[i].first, entryNames[i].second);
+                    }
+                    else {
+                        lockedPatronCode(entryNames[i].first, {});
+                    }
+                }
+            }
+            else if (kind == EventBlock && size - pos >= static_cast<size_t>(entries) * 13) {
+                const char* book = data + pos;
+                const char* patron = book + static_cast<size_t>(entries) * 4;
+                const char* time = patron + static_cast<size_t>(entries) * 4;
+                const char* type = time + static_cast<size_t>(entries) * 4;
+                for (uint32_t i = 0; i < entries; i++) {
+                    uint32_t values[3];
+                    std::memcpy(&values[0], book + i * 4, 4);
+                    std::memcpy(&values[1], patron + i * 4, 4);
+                    std::memcpy(&values[2], time + i * 4, 4);
+                    if (values[0] < books.size() && values[1] < patrons.size()) {
+                        append(values[0], values[1], std::max(values[2], lastTime), static_cast<uint8_t>(type[i]));
+                    }
+                }
+                pos += static_cast<size_t>(entries) * 13;
+            }
+            else {
+                complete = false;
+            }
+            if (!complete) {
+                return blockStart;
+            }
+        }
+        return pos;
+    }
+
+public:
+    CirculationLog() = default;
+    ~CirculationLog() { close(); }
+    CirculationLog(const CirculationLog&) = delete;
+    CirculationLog& operator=(const CirculationLog&) = delete;
+
+    // Function to load the history saved in a file and keep appending to it. Call before the
+    // log is shared with other threads
+    bool open(const std::string& fileName) {
+        close();
+        path = fileName;
+        size_t valid = load(fileName);
+        std::error_code ec;
+        if (valid == 0) {
+            // The magic is written by the first flush
+            file = std::fopen(fileName.c_str(), "wb");
+        }
+        else {
+            if (valid < std::filesystem::file_size(fileName, ec)) {
+                std::filesystem::resize_file(fileName, valid, ec);
+            }
+            file = std::fopen(fileName.c_str(), "ab");
+        }
+        savedEvents = count;
+        savedBooks = books.size();
+        savedPatrons = patrons.size();
+        savedBytes = valid;
+        return file != nullptr && flush();
+    }
+
+    void close() {
+        flush();
+        std::lock_guard<std::mutex> lock(fileMutex);
+        if (file) {
+            std::fclose(file);
+            file = nullptr;
+        }
+        path.clear();
+    }
+
+    // Function to find the dictionary code of a book or patron, adding it if it is new. Codes
+    // never change, so callers may keep them to record events without a dictionary lookup
+    uint32_t bookCode(std::string_view title, std::string_view author) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return lockedBookCode(title, author);
+    }
+    uint32_t patronCode(std::string_view firstName, std::string_view lastName) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return lockedPatronCode(firstName, lastName);
+    }
+
+    // Function to record an event at a Unix time, by the codes of its book and patron. Safe
+    // to call from any thread
+    void record(CirculationEvent type, uint32_t book, uint32_t patron, int64_t unixTime) {
+        std::lock_guard<std::mutex> lock(mutex);
+        append(book, patron, std::max(storedTime(unixTime), lastTime), static_cast<uint8_t>(type));
+    }
+    void record(CirculationEvent type, std::string_view title, std::string_view author, std::string_view patronFirst,
+        std::string_view patronLast, int64_t unixTime) {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint32_t book = lockedBookCode(title, author);
+        uint32_t patron = lockedPatronCode(patronFirst, patronLast);
+        append(book, patron, std::max(storedTime(unixTime), lastTime), static_cast<uint8_t>(type));
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return count;
+    }
+
+    // Function to append the events and dictionary entries added since the last flush to the
+    // file. The data is copied under the mutex and written after it is released
+    bool flush() {
+        std::lock_guard<std::mutex> fileLock(fileMutex);
+        if (path.empty()) {
+            return true;
+        }
+        std::string block;
+        if (savedBytes == 0) {
+            block.append(magic, sizeof(magic));
+        }
+        auto put32 = [&block](uint32_t value) { block.append(reinterpret_cast<const char*>(&value), sizeof(value)); };
+        size_t bookCount, patronCount, eventCount;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            bookCount = books.size();
+            patronCount = patrons.size();
+            eventCount = count;
+            if (bookCount > savedBooks) {
+                put32(BookBlock);
+                put32(static_cast<uint32_t>(bookCount - savedBooks));
+                for (size_t i = savedBooks; i < bookCount; i++) {
+                    put32(static_cast<uint32_t>(books[i].first.size()));
+                    put32(static_cast<uint32_t>(books[i].second.size()));
+                    block += books[i].first;
+                    block += books[i].second;
+                }
+            }
+            if (patronCount > savedPatrons) {
+                put32(PatronBlock);
+                put32(static_cast<uint32_t>(patronCount - savedPatrons));
+                for (size_t i = savedPatrons; i < patronCount; i++) {
+                    put32(static_cast<uint32_t>(patrons[i].size()));
+                    block += patrons[i];
+                }
+            }
+            if (eventCount > savedEvents) {
+                put32(EventBlock);
+                put32(static_cast<uint32_t>(eventCount - savedEvents));
+                auto column = [this, &block, eventCount](auto member, size_t width) {
+                    for (size_t i = savedEvents; i < eventCount; i++) {
+                        const Chunk& chunk = *chunks[i / chunkSize];
+                        block.append(reinterpret_cast<const char*>(&(chunk.*member)[i % chunkSize]), width);
+                    }
+                };
+                column(&Chunk::book, 4);
+                column(&Chunk::patron, 4);
+                column(&Chunk::time, 4);
+                column(&Chunk::type, 1);
+            }
+        }
+        if (block.empty()) {
+            return true;
+        }
+        if (file && std::fwrite(block.data(), 1, block.size(), file) == block.size() && std::fflush(file) == 0) {
+            savedBooks = bookCount;
+            savedPatrons = patronCount;
+            savedEvents = eventCount;
+            savedBytes += block.size();
+            return true;
+        }
+        // Cut off whatever part of the blocks reached the file, they are written again whole
+        // by the next flush
+        if (file) {
+            std::fclose(file);
+        }
+        std::error_code ec;
+        std::filesystem::resize_file(path, savedBytes, ec);
+        file = ec ? nullptr : std::fopen(path.c_str(), "ab");
+        return false;
+    }
+
+    // Function to rank the most borrowed titles ("Title by Author") in [from, to), Unix seconds
+    std::vector<Ranked> topTitles(size_t k, int64_t from, int64_t to) const {
+        View snapshot = view();
+        size_t codes;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            codes = books.size();
+        }
+        std::vector<uint32_t> counts = checkoutsPer(snapshot, from, to, codes, [](const Chunk& chunk) { return chunk.book; });
+        return topK(counts, k, [this](uint32_t code) { return books[code].first + " by " + books[code].second; });
+    }
+
+    // Function to rank the authors whose books were borrowed most in [from, to)
+    std::vector<Ranked> topAuthors(size_t k, int64_t from, int64_t to) const {
+        View snapshot = view();
+        size_t codes;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            codes = books.size();
+        }
+        std::vector<uint32_t> perBook = checkoutsPer(snapshot, from, to, codes, [](const Chunk& chunk) { return chunk.book; });
+        std::vector<uint32_t> counts;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            counts.assign(authors.size(), 0);
+            for (size_t code = 0; code < perBook.size(); code++) {
+                counts[bookAuthor[code]] += perBook[code];
+            }
+        }
+        return topK(counts, k, [this](uint32_t code) { return authors[code]; });
+    }
+
+    // Function to rank the patrons who borrowed most in [from, to)
+    std::vector<Ranked> topPatrons(size_t k, int64_t from, int64_t to) const {
+        View snapshot = view();
+        std::vector<uint32_t> counts = checkoutsPer(snapshot, from, to, dictionarySize(patrons), [](const Chunk& chunk) { return chunk.patron; });
+        return topK(counts, k, [this](uint32_t code) { return patrons[code]; });
+    }
+
+    // Function to count checkouts and returns per bucket of bucketSeconds from from up to to
+    std::vector<std::array<uint64_t, 2>> activity(int64_t from, int64_t to, int64_t bucketSeconds) const {
+        std::vector<std::array<uint64_t, 2>> buckets;
+        if (to <= from || bucketSeconds <= 0) {
+            return buckets;
+        }
+        size_t bucketCount = static_cast<size_t>((to - from + bucketSeconds - 1) / bucketSeconds);
+        std::vector<uint32_t> counts(bucketCount * 2, 0);
+        View snapshot = view();
+        // An event at stored time t happened at t + timeEpoch, offset turns that into seconds
+        // from from. Both fit 32 bits unless from is before the epoch
+        int64_t offset = timeEpoch - from;
+        if (offset <= 0 && bucketSeconds <= UINT32_MAX) {
+            uint32_t start = static_cast<uint32_t>(-offset), width = static_cast<uint32_t>(bucketSeconds);
+            scan(snapshot, from, to, [&counts, start, width](const Chunk& chunk, size_t begin, size_t end) {
+                uint32_t* out = counts.data();
+                for (size_t i = begin; i < end; i++) {
+                    out[(chunk.time[i] - start) / width * 2 + chunk.type[i]]++;
+                }
+                });
+        }
+        else {
+            scan(snapshot, from, to, [&counts, offset, bucketSeconds](const Chunk& chunk, size_t begin, size_t end) {
+                uint32_t* out = counts.data();
+                for (size_t i = begin; i < end; i++) {
+                    out[(chunk.time[i] + offset) / bucketSeconds * 2 + chunk.type[i]]++;
+                }
+                });
+        }
+        buckets.resize(bucketCount);
+        for (size_t i = 0; i < bucketCount; i++) {
+            buckets[i] = { counts[i * 2], counts[i * 2 + 1] };
+        }
+        return buckets;
+    }
+};
@@ -0,0 +1,71 @@
+#pragma once
+#include <streambuf>
+#include <vector>
+#ifndef _WIN32
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+// Buffered stream buffer over a connected socket or pipe, so a session can use the same
+// istream/ostream code as the console. Output is sent on flush or when the buffer fills.
+class FdStreamBuf : public std::streambuf {
+private:
+    int fd;
+    std::vector<char> input, output;
+
+public:
+    explicit FdStreamBuf(int descriptor, size_t bufferSize = 16 * 1024)
+        : fd(descriptor), input(bufferSize), output(bufferSize) {
+        setg(input.data(), input.data(), input.data());
+        setp(output.data(), output.data() + output.size());
+    }
+    ~FdStreamBuf() override { sync(); }
+    FdStreamBuf(const FdStreamBuf&) = delete;
+    FdStreamBuf& operator=(const FdStreamBuf&) = delete;
+
+protected:
+    int_type underflow() override {
+#ifndef _WIN32
+        ssize_t got;
+        do {
+            got = ::read(fd, input.data(), input.size());
+        } while (got < 0 && errno == EINTR);
+        if (got > 0) {
+            setg(input.data(), input.data(), input.data() + got);
+            return traits_type::to_int_type(input[0]);
+        }
+#endif
+        return traits_type::eof();
+    }
+
+    int_type overflow(int_type c) override {
+        if (sync() != 0) {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override {
+        int result = 0;
+#ifndef _WIN32
+        const char* next = pbase();
+        while (next < pptr()) {
+            ssize_t sent = ::write(fd, next, static_cast<size_t>(pptr() - next));
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent <= 0) {
+                result = -1;
+                break;
+            }
+            next += sent;
+        }
+#endif
+        setp(output.data(), output.data() + output.size());
+        return result;
+    }
+};
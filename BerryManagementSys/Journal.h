@@ -0,0 +1,265 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <initializer_list>
+#include <filesystem>
+#include <system_error>
+#include "MappedFile.h"
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Append-only binary write-ahead journal.
+//
+// Every record is framed as [u32 payload length][u32 checksum][payload] where the payload is
+// [u8 op][i64 timestamp][u16 field count] followed by [u32 length][bytes] per field. Records are
+// staged in memory and written together by commit() (group commit), so a burst of mutations
+// costs one write and one flush. Replay stops at the first torn or corrupt record and the tail is
+// truncated away, so a crash mid-write only loses the uncommitted group. A group that fails to
+// write is cut off the file again and stays staged for the next commit.
+//
+// A journal that follows a checkpoint starts with an epoch record (op 0) naming the checkpoint.
+// A checkpoint stores the epoch of the journal that comes after it, so a journal whose epoch is
+// older than the checkpoint's was folded into it already and must not be replayed on top.
+class Journal {
+private:
+    std::string path;
+    FILE* file = nullptr;
+    std::string pending;
+    size_t pendingRecords = 0;
+    uint64_t fileSize = 0;
+    uint64_t fileEpoch = 0;
+    bool failed = false;
+
+    static const size_t headerSize = 8;
+    static const uint8_t epochOp = 0;
+
+    static uint32_t checksum(const char* data, size_t size) {
+        uint32_t hash = 2166136261u; // FNV-1a
+        for (size_t i = 0; i < size; i++) {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    template<typename T>
+    void put(T value) {
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        pending.append(bytes, sizeof(T));
+    }
+
+    template<typename T>
+    static T get(const char* data) {
+        T value;
+        std::memcpy(&value, data, sizeof(T));
+        return value;
+    }
+
+    // Function to cut the file back to its committed size and reopen it, after a write that may
+    // have left part of a group behind
+    bool truncateToCommitted() {
+        if (file) {
+            std::fclose(file);
+            file = nullptr;
+        }
+        std::error_code ec;
+        std::filesystem::resize_file(path, fileSize, ec);
+        if (ec) {
+            return false;
+        }
+        file = std::fopen(path.c_str(), "ab");
+        return file != nullptr;
+    }
+
+    // Function to parse the record at pos of a mapped journal into op and fields. Returns the
+    // size of the record, or 0 if it is torn or corrupt
+    static size_t parse(const char* data, size_t size, size_t pos, uint8_t& op, int64_t& timestamp, std::vector<std::string_view>& fields) {
+        if (pos + headerSize > size) {
+            return 0;
+        }
+        uint32_t payloadSize = get<uint32_t>(data + pos);
+        uint32_t sum = get<uint32_t>(data + pos + 4);
+        const char* payload = data + pos + headerSize;
+        if (payloadSize < 11 || payloadSize > size - pos - headerSize || checksum(payload, payloadSize) != sum) {
+            return 0;
+        }
+        op = get<uint8_t>(payload);
+        timestamp = get<int64_t>(payload + 1);
+        uint16_t fieldCount = get<uint16_t>(payload + 9);
+        size_t fieldPos = 11;
+        fields.clear();
+        for (uint16_t i = 0; i < fieldCount; i++) {
+            if (fieldPos + 4 > payloadSize) {
+                return 0;
+            }
+            uint32_t length = get<uint32_t>(payload + fieldPos);
+            fieldPos += 4;
+            if (length > payloadSize - fieldPos) {
+                return 0;
+            }
+            fields.emplace_back(payload + fieldPos, length);
+            fieldPos += length;
+        }
+        return headerSize + payloadSize;
+    }
+
+public:
+    // Pending bytes that force a commit even if the caller has not asked for one yet
+    size_t groupCommitBytes = 64 * 1024;
+    // Whether commit() also asks the OS to push the group to disk
+    bool syncOnCommit = true;
+
+    Journal() = default;
+    ~Journal() { close(); }
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // Function to open the journal for appending, creating it if needed
+    bool open(const std::string& fileName) {
+        close();
+        path = fileName;
+        file = std::fopen(path.c_str(), "ab");
+        if (!file) {
+            return false;
+        }
+        std::error_code ec;
+        auto size = std::filesystem::file_size(path, ec);
+        fileSize = ec ? 0 : size;
+        fileEpoch = epochOf(path);
+        failed = false;
+        return true;
+    }
+
+    void close() {
+        if (file) {
+            commit();
+            std::fclose(file);
+            file = nullptr;
+        }
+    }
+
+    bool isOpen() const { return file != nullptr || failed; }
+    uint64_t size() const { return fileSize + pending.size(); }
+    size_t pendingCount() const { return pendingRecords; }
+    uint64_t epoch() const { return fileEpoch; }
+    // True from a commit that failed until one succeeds, the failed group is still staged
+    bool failing() const { return failed; }
+
+    // Function to stage one record, it becomes durable on the next commit
+    void append(uint8_t op, int64_t timestamp, std::initializer_list<std::string_view> fields) {
+        size_t start = pending.size();
+        put<uint32_t>(0);
+        put<uint32_t>(0);
+        put<uint8_t>(op);
+        put<int64_t>(timestamp);
+        put<uint16_t>(static_cast<uint16_t>(fields.size()));
+        for (std::string_view field : fields) {
+            put<uint32_t>(static_cast<uint32_t>(field.size()));
+            pending.append(field.data(), field.size());
+        }
+        uint32_t payloadSize = static_cast<uint32_t>(pending.size() - start - headerSize);
+        uint32_t sum = checksum(pending.data() + start + headerSize, payloadSize);
+        std::memcpy(&pending[start], &payloadSize, sizeof(payloadSize));
+        std::memcpy(&pending[start + 4], &sum, sizeof(sum));
+        pendingRecords++;
+        if (pending.size() >= groupCommitBytes) {
+            commit();
+        }
+    }
+
+    // Function to write every staged record with a single write and flush. On failure whatever
+    // part of the group reached the file is cut off again, so later groups do not land behind a
+    // torn record, and the group stays staged for the next commit to retry
+    bool commit() {
+        if (!isOpen() || pending.empty()) {
+            return true;
+        }
+        bool ok = (file || truncateToCommitted())
+            && std::fwrite(pending.data(), 1, pending.size(), file) == pending.size() && std::fflush(file) == 0;
+#ifndef _WIN32
+        if (ok && syncOnCommit) {
+            ok = fsync(fileno(file)) == 0;
+        }
+#endif
+        if (!ok) {
+            failed = true;
+            truncateToCommitted();
+            return false;
+        }
+        fileSize += pending.size();
+        pending.clear();
+        pendingRecords = 0;
+        failed = false;
+        return true;
+    }
+
+    // Function to discard the journal contents once they are covered by the checkpoint of
+    // epoch, and start the journal with that epoch
+    bool reset(uint64_t epoch) {
+        pending.clear();
+        pendingRecords = 0;
+        if (file) {
+            std::fclose(file);
+        }
+        file = std::fopen(path.c_str(), "wb");
+        fileSize = 0;
+        fileEpoch = epoch;
+        failed = file == nullptr;
+        append(epochOp, 0, { std::to_string(epoch) });
+        return commit();
+    }
+
+    // Function to read the epoch of a journal file, 0 if it has no epoch record
+    static uint64_t epochOf(const std::string& fileName) {
+        MappedFile mapped;
+        if (!mapped.open(fileName)) {
+            return 0;
+        }
+        uint8_t op = 0;
+        int64_t timestamp = 0;
+        std::vector<std::string_view> fields;
+        if (parse(mapped.data(), mapped.size(), 0, op, timestamp, fields) == 0 || op != epochOp || fields.empty()) {
+            return 0;
+        }
+        return std::strtoull(std::string(fields[0]).c_str(), nullptr, 10);
+    }
+
+    // Function to replay every intact record in a journal file through
+    // onRecord(op, timestamp, fields). Returns the number of records replayed.
+    template<typename OnRecord>
+    static size_t replay(const std::string& fileName, OnRecord onRecord) {
+        size_t records = 0, validBytes = 0, totalBytes = 0;
+        {
+            MappedFile mapped;
+            if (!mapped.open(fileName)) {
+                return 0;
+            }
+            const char* data = mapped.data();
+            totalBytes = mapped.size();
+            std::vector<std::string_view> fields;
+            uint8_t op = 0;
+            int64_t timestamp = 0;
+            size_t pos = 0;
+            while (size_t recordSize = parse(data, totalBytes, pos, op, timestamp, fields)) {
+                if (op != epochOp) {
+                    onRecord(op, timestamp, fields);
+                    records++;
+                }
+                pos += recordSize;
+                validBytes = pos;
+            }
+        }
+        if (validBytes < totalBytes) {
+            std::error_code ec;
+            std::filesystem::resize_file(fileName, validBytes, ec);
+        }
+        return records;
+    }
+};
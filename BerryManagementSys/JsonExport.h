@@ -0,0 +1,158 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "Snapshot.h"
+#include "ThreadPool.h"
+
+// Streaming writer of book catalogs in the JSON format readFromFile reads. Books are encoded in
+// chunks on a thread pool straight from (title, author, checkedOut) records, no json DOM is
+// built, and the chunks are written in order as they finish with only a few in flight at once.
+// Pretty output is byte for byte what nlohmann's dump(4) gives for the same books (keys in
+// sorted order, four space indent), compact output what dump() gives. The file goes to a
+// temporary name and replaces the target only once it is complete.
+namespace jsonexport {
+
+struct Record {
+    std::string_view title;
+    std::string_view author;
+    bool checkedOut;
+};
+
+enum class Filter : uint8_t { All, CheckedOut, Available };
+
+struct Options {
+    bool pretty = true;
+    Filter filter = Filter::All;
+    size_t threads = 0; // 0 for one per hardware thread
+};
+
+struct Report {
+    size_t books = 0;
+    uint64_t bytes = 0;
+    double seconds = 0;
+    size_t peakBufferBytes = 0; // records plus the encoded chunks held at once
+};
+
+// Function to append str as a JSON string, escaped the way nlohmann's serializer escapes it.
+// Bytes of 0x80 and up are copied, the catalog holds UTF-8
+inline void appendString(std::string& out, std::string_view str) {
+    static const char hex[] = "0123456789abcdef";
+    out.push_back('"');
+    size_t plain = 0;
+    for (size_t i = 0; i < str.size(); i++) {
+        unsigned char c = static_cast<unsigned char>(str[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out.append(str.data() + plain, i - plain);
+        plain = i + 1;
+        switch (c) {
+        case '"': out.append("\\\""); break;
+        case '\\': out.append("\\\\"); break;
+        case '\b': out.append("\\b"); break;
+        case '\f': out.append("\\f"); break;
+        case '\n': out.append("\\n"); break;
+        case '\r': out.append("\\r"); break;
+        case '\t': out.append("\\t"); break;
+        default:
+            out.append("\\u00");
+            out.push_back(hex[c >> 4]);
+            out.push_back(hex[c & 15]);
+            break;
+        }
+    }
+    out.append(str.data() + plain, str.size() - plain);
+    out.push_back('"');
+}
+
+// Function to encode records [first, last) of the array, each preceded by the separator from the
+// record before it unless it is the first of the whole array
+inline std::string encodeChunk(const std::vector<Record>& records, size_t first, size_t last, bool pretty) {
+    std::string out;
+    size_t estimate = 0;
+    for (size_t i = first; i < last; i++) {
+        estimate += records[i].title.size() + records[i].author.size();
+    }
+    out.reserve(estimate + (last - first) * (pretty ? 96 : 48));
+    for (size_t i = first; i < last; i++) {
+        const Record& record = records[i];
+        if (pretty) {
+            out.append(i == 0 ? "    {\n        \"Author\": " : ",\n    {\n        \"Author\": ");
+            appendString(out, record.author);
+            out.append(record.checkedOut ? ",\n        \"CheckedOut\": true,\n        \"Title\": " : ",\n        \"CheckedOut\": false,\n        \"Title\": ");
+            appendString(out, record.title);
+            out.append("\n    }");
+        }
+        else {
+            out.append(i == 0 ? "{\"Author\":" : ",{\"Author\":");
+            appendString(out, record.author);
+            out.append(record.checkedOut ? ",\"CheckedOut\":true,\"Title\":" : ",\"CheckedOut\":false,\"Title\":");
+            appendString(out, record.title);
+            out.push_back('}');
+        }
+    }
+    return out;
+}
+
+// Function to write records as a JSON array to fileName. Returns false if the file could not
+// be written, the previous file is then left in place
+inline bool writeBooks(const std::vector<Record>& records, const std::string& fileName, const Options& options, Report& report) {
+    const size_t chunkSize = 8192;
+    auto start = std::chrono::steady_clock::now();
+    size_t chunks = (records.size() + chunkSize - 1) / chunkSize;
+    size_t threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::max<size_t>(1, std::min(threads, chunks));
+    // Two chunks per thread in flight keep every worker busy while the oldest is written
+    size_t inFlightLimit = 2 * threads;
+
+    report = Report();
+    report.books = records.size();
+    snapshot::Writer writer(fileName);
+    auto write = [&writer, &report](std::string_view text) {
+        writer.write(text.data(), text.size());
+        report.bytes += text.size();
+    };
+    write(records.empty() ? "[" : (options.pretty ? "[\n" : "["));
+    {
+        std::unique_ptr<ThreadPool> pool = threads > 1 ? std::make_unique<ThreadPool>(threads) : nullptr;
+        std::deque<std::future<std::string>> inFlight;
+        size_t largestChunk = 0;
+        auto put = [&](const std::string& chunk) {
+            largestChunk = std::max(largestChunk, chunk.capacity());
+            write(chunk);
+        };
+        for (size_t c = 0; c < chunks; c++) {
+            size_t first = c * chunkSize, last = std::min(records.size(), first + chunkSize);
+            if (!pool) {
+                put(encodeChunk(records, first, last, options.pretty));
+                continue;
+            }
+            if (inFlight.size() == inFlightLimit) {
+                put(inFlight.front().get());
+                inFlight.pop_front();
+            }
+            inFlight.push_back(pool->submit([&records, first, last, &options] { return encodeChunk(records, first, last, options.pretty); }));
+        }
+        while (!inFlight.empty()) {
+            put(inFlight.front().get());
+            inFlight.pop_front();
+        }
+        // At most the in-flight limit of chunks are encoded and not yet written at once
+        report.peakBufferBytes = records.capacity() * sizeof(Record) + (pool ? std::min(chunks, inFlightLimit) : 1) * largestChunk;
+    }
+    write(records.empty() ? "]" : (options.pretty ? "\n]" : "]"));
+    bool written = writer.commit();
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return written;
+}
+
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include <cstdint>
+#include <ctime>
+#include <vector>
+#include "TimerWheel.h"
+
+using BookId = uint32_t;
+using PatronId = uint32_t;
+const uint32_t NoId = UINT32_MAX;
+
+// Central table of active loans keyed by compact book and patron IDs.
+//
+// Loans live in one contiguous vector and freed slots are reused through a free list. Each
+// patron's loans form an intrusive doubly linked list threaded through the table, so checkout,
+// return and "loans of this patron" need no per-patron allocation. bookLoans maps a book ID to
+// its loan so a return finds the loan in O(1). Every loan has a due time on a timer wheel keyed
+// by loan slot, so the loans that fall overdue are found without looking at the others.
+class LoanTable {
+public:
+    struct Loan {
+        BookId book;
+        PatronId patron;
+        uint32_t prev;
+        uint32_t next;
+        int64_t due; // Unix time
+    };
+
+private:
+    std::vector<Loan> loans;
+    std::vector<uint32_t> patronHeads;
+    std::vector<uint32_t> patronTails;
+    std::vector<uint32_t> bookLoans;
+    uint32_t freeList = NoId;
+    size_t active = 0;
+    TimerWheel dueDates{ static_cast<int64_t>(std::time(nullptr)) };
+
+    template<typename T>
+    static void ensure(std::vector<T>& table, uint32_t id) {
+        if (id >= table.size()) {
+            table.resize(static_cast<size_t>(id) + 1, NoId);
+        }
+    }
+
+public:
+    size_t size() const { return active; }
+    size_t overdueCount() const { return dueDates.overdueCount(); }
+    const Loan& at(uint32_t loan) const { return loans[loan]; }
+
+    // Returns the loan of a book, NoId if it is not on loan
+    uint32_t loanOf(BookId book) const {
+        return book < bookLoans.size() ? bookLoans[book] : NoId;
+    }
+
+    // Function to record a new loan due at a Unix time, O(1)
+    uint32_t add(BookId book, PatronId patron, int64_t due) {
+        ensure(patronHeads, patron);
+        ensure(patronTails, patron);
+        ensure(bookLoans, book);
+        uint32_t loan;
+        if (freeList != NoId) {
+            loan = freeList;
+            freeList = loans[loan].next;
+        }
+        else {
+            loan = static_cast<uint32_t>(loans.size());
+            loans.push_back({});
+        }
+        uint32_t tail = patronTails[patron];
+        loans[loan] = { book, patron, tail, NoId, due };
+        if (tail != NoId) {
+            loans[tail].next = loan;
+        }
+        else {
+            patronHeads[patron] = loan;
+        }
+        patronTails[patron] = loan;
+        bookLoans[book] = loan;
+        dueDates.schedule(loan, due);
+        active++;
+        return loan;
+    }
+
+    // Function to end a loan and put its slot on the free list, O(1)
+    void remove(uint32_t loan) {
+        Loan& entry = loans[loan];
+        if (entry.prev != NoId) {
+            loans[entry.prev].next = entry.next;
+        }
+        else {
+            patronHeads[entry.patron] = entry.next;
+        }
+        if (entry.next != NoId) {
+            loans[entry.next].prev = entry.prev;
+        }
+        else {
+            patronTails[entry.patron] = entry.prev;
+        }
+        bookLoans[entry.book] = NoId;
+        dueDates.cancel(loan);
+        entry = { NoId, NoId, NoId, freeList, 0 };
+        freeList = loan;
+        active--;
+    }
+
+    // Function to call onLoan(bookId) for every loan of a patron, in checkout order
+    template<typename OnLoan>
+    void forEachLoanOf(PatronId patron, OnLoan onLoan) const {
+        if (patron >= patronHeads.size()) {
+            return;
+        }
+        for (uint32_t loan = patronHeads[patron]; loan != NoId; loan = loans[loan].next) {
+            onLoan(loans[loan].book);
+        }
+    }
+
+    // Function to end every loan of a patron, calling onBook(bookId) for each released book
+    template<typename OnBook>
+    void releasePatron(PatronId patron, OnBook onBook) {
+        while (patron < patronHeads.size() && patronHeads[patron] != NoId) {
+            uint32_t loan = patronHeads[patron];
+            onBook(loans[loan].book);
+            remove(loan);
+        }
+    }
+
+    // Function to move the loan clock to a Unix time, calling onOverdue(loan) for every loan that
+    // falls overdue on the way. Costs O(loans falling due) plus a constant per elapsed minute
+    template<typename OnOverdue>
+    void advanceClock(int64_t now, OnOverdue onOverdue) {
+        dueDates.advance(now, [this, &onOverdue](uint32_t loan) { onOverdue(loans[loan]); });
+    }
+
+    // Function to call onLoan(loan) for every overdue loan as of the last advanceClock, in the
+    // order they fell due
+    template<typename OnLoan>
+    void forEachOverdue(OnLoan onLoan) const {
+        dueDates.forEachOverdue([this, &onLoan](uint32_t loan) { onLoan(loans[loan]); });
+    }
+};
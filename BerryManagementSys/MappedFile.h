@@ -0,0 +1,97 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file. Uses mmap where available and falls back to reading
+// the file into a buffer, so callers only ever see a contiguous [data, data + size) range.
+class MappedFile {
+private:
+    const char* mappedData = nullptr;
+    size_t mappedSize = 0;
+    std::vector<char> buffer;
+    bool mapped = false;
+
+    void release() {
+#ifndef _WIN32
+        if (mapped && mappedData) {
+            munmap(const_cast<char*>(mappedData), mappedSize);
+        }
+#endif
+        mappedData = nullptr;
+        mappedSize = 0;
+        buffer.clear();
+        mapped = false;
+    }
+
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string& fileName) { open(fileName); }
+    ~MappedFile() { release(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            release();
+            mappedData = other.mappedData;
+            mappedSize = other.mappedSize;
+            buffer = std::move(other.buffer);
+            mapped = other.mapped;
+            if (!mapped && !buffer.empty()) {
+                mappedData = buffer.data();
+            }
+            other.mappedData = nullptr;
+            other.mappedSize = 0;
+            other.mapped = false;
+        }
+        return *this;
+    }
+
+    // Returns false if the file could not be opened. A sequential mapping is read ahead
+    // aggressively; pass false for a file that is probed at random
+    bool open(const std::string& fileName, bool sequential = true) {
+        release();
+#ifndef _WIN32
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                madvise(data, static_cast<size_t>(info.st_size), sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+                mappedData = static_cast<const char*>(data);
+                mappedSize = static_cast<size_t>(info.st_size);
+                mapped = true;
+            }
+        }
+        ::close(fd);
+        if (mapped) {
+            return true;
+        }
+#endif
+        std::ifstream inFile(fileName, std::ios::binary);
+        if (!inFile.is_open()) {
+            return false;
+        }
+        buffer.assign(std::istreambuf_iterator<char>(inFile), std::istreambuf_iterator<char>());
+        mappedData = buffer.data();
+        mappedSize = buffer.size();
+        return true;
+    }
+
+    const char* data() const { return mappedData; }
+    size_t size() const { return mappedSize; }
+    const char* begin() const { return mappedData; }
+    const char* end() const { return mappedData + mappedSize; }
+};
@@ -0,0 +1,116 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "SearchIndex.h"
+
+// Bounded LRU cache of ranked search results keyed by case-folded query. An entry keeps the
+// SearchStamp its hits were ranked under and is only used while the query's stamp is still the
+// same, so a mutation makes stale exactly the queries whose trigrams it touched and nothing is
+// ever flushed. The cache is split into shards on separate cache lines, each with its own
+// lock and LRU list, so desks searching at once rarely wait for each other.
+class SearchCache {
+private:
+    static const size_t shardCount = 16;
+
+    struct Entry {
+        std::string query;
+        size_t k;
+        SearchStamp stamp;
+        std::vector<SearchHit> hits;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::list<Entry> entries; // most recently used first
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> byQuery; // keys view Entry::query
+    };
+    Shard shards[shardCount];
+    size_t shardCapacity;
+    std::atomic<uint64_t> hitCount{ 0 }, missCount{ 0 }, staleCount{ 0 };
+
+    static std::string folded(std::string_view query) {
+        std::string key(query);
+        for (char& c : key) {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        return key;
+    }
+    Shard& shardOf(std::string_view key) { return shards[std::hash<std::string_view>()(key) % shardCount]; }
+
+public:
+    explicit SearchCache(size_t capacity = 4096) : shardCapacity(std::max<size_t>(1, capacity / shardCount)) {}
+    SearchCache(const SearchCache&) = delete;
+    SearchCache& operator=(const SearchCache&) = delete;
+
+    // Function to copy the cached top k hits of a query into hits. Returns false if the query is
+    // not cached or its entry was ranked under another stamp, which drops the entry
+    bool find(std::string_view query, size_t k, const SearchStamp& stamp, std::vector<SearchHit>& hits) {
+        std::string key = folded(query);
+        Shard& shard = shardOf(key);
+        std::lock_guard<std::mutex> guard(shard.mutex);
+        auto it = shard.byQuery.find(key);
+        if (it == shard.byQuery.end() || it->second->k != k) {
+            missCount.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (!(it->second->stamp == stamp)) {
+            auto entry = it->second;
+            shard.byQuery.erase(it);
+            shard.entries.erase(entry);
+            staleCount.fetch_add(1, std::memory_order_relaxed);
+            missCount.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        hits = it->second->hits;
+        hitCount.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Function to cache the hits of a query ranked under stamp, evicting the least recently
+    // used entry of its shard when the shard is full
+    void store(std::string_view query, size_t k, const SearchStamp& stamp, const std::vector<SearchHit>& hits) {
+        std::string key = folded(query);
+        Shard& shard = shardOf(key);
+        std::lock_guard<std::mutex> guard(shard.mutex);
+        auto it = shard.byQuery.find(key);
+        if (it != shard.byQuery.end()) {
+            Entry& entry = *it->second;
+            entry.k = k;
+            entry.stamp = stamp;
+            entry.hits = hits;
+            shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+            return;
+        }
+        if (shard.entries.size() >= shardCapacity) {
+            shard.byQuery.erase(shard.entries.back().query);
+            shard.entries.pop_back();
+        }
+        shard.entries.push_front({ std::move(key), k, stamp, hits });
+        shard.byQuery.emplace(shard.entries.front().query, shard.entries.begin());
+    }
+
+    size_t capacity() const { return shardCapacity * shardCount; }
+    size_t size() {
+        size_t total = 0;
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> guard(shard.mutex);
+            total += shard.entries.size();
+        }
+        return total;
+    }
+
+    uint64_t hits() const { return hitCount.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return missCount.load(std::memory_order_relaxed); }
+    uint64_t stale() const { return staleCount.load(std::memory_order_relaxed); }
+};
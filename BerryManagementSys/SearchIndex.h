@@ -0,0 +1,515 @@
+#pragma once
+#include <cstdint>
+#include <cctype>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include "LoanTable.h"
+
+// How a search hit matched, in ranking order
+enum class MatchKind { ExactTitle, TitlePrefix, TitleWordPrefix, TitleSubstring, Author, Fuzzy };
+
+struct SearchHit {
+    BookId id;
+    MatchKind kind;
+    int distance; // edit distance for fuzzy hits, 0 otherwise
+    size_t length; // title length, shorter titles rank first within a kind
+};
+
+// What the results of one query depend on: the change counters of its trigrams and, for
+// queries that may fall back to fuzzy matching, the posting list limit. Equal stamps taken at
+// two times mean the query returns the same hits at both
+struct SearchStamp {
+    uint64_t grams = 0;
+    size_t fuzzyLimit = 0;
+    bool operator==(const SearchStamp&) const = default;
+};
+
+// Inverted trigram index over the case-folded titles and authors of the catalog.
+//
+// Every book contributes the distinct trigrams of "\x02title" and "\x02author", the leading
+// marker makes prefixes searchable from two characters. Substring queries intersect the sorted
+// posting lists of their trigrams and verify what is left, fuzzy queries count shared trigrams to pick
+// candidates for an approximate substring edit distance check. Removal is lazy: removed books are skipped at
+// query time and purged from the posting lists once they make up a quarter of the entries.
+//
+// Adding or removing a book bumps a change counter for each of its trigrams, hashed into a fixed
+// table. A query only looks at books sharing one of its trigrams, so the sum of the counters of
+// its trigrams (its stamp) changes whenever its results may have.
+//
+// The posting lists can be saved with a snapshot and restored from it without touching a title
+// (see forEachPosting and restore). A restored list is read where it lies in the mapped file
+// and copied out the first time it changes.
+class SearchIndex {
+private:
+    struct PostingList {
+        std::span<const BookId> mapped;
+        std::vector<BookId> owned;
+        std::span<const BookId> ids() const { return mapped.empty() ? std::span<const BookId>(owned) : mapped; }
+    };
+
+    std::unordered_map<uint32_t, PostingList> postings;
+    std::vector<uint8_t> indexed;
+    size_t liveEntries = 0, deadEntries = 0, liveBooks = 0;
+    static const size_t stampBits = 16;
+    std::vector<uint32_t> stamps = std::vector<uint32_t>(size_t(1) << stampBits, 0);
+
+    static const char marker = '\x02';
+
+    static char fold(char c) {
+        return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+
+    static void foldInto(std::string_view text, std::string& out) {
+        out.assign(1, marker);
+        for (char c : text) {
+            out.push_back(fold(c));
+        }
+    }
+
+    static uint32_t gram(const char* p) {
+        return static_cast<uint32_t>(static_cast<unsigned char>(p[0])) << 16 |
+            static_cast<uint32_t>(static_cast<unsigned char>(p[1])) << 8 |
+            static_cast<uint32_t>(static_cast<unsigned char>(p[2]));
+    }
+
+    static void gramsOf(const std::string& folded, std::vector<uint32_t>& grams) {
+        for (size_t i = 0; i + 3 <= folded.size(); i++) {
+            grams.push_back(gram(folded.data() + i));
+        }
+    }
+
+    static size_t stampOfGram(uint32_t g) { return (g * 2654435761u) >> (32 - stampBits); }
+
+    // Function to get a list to change, copying a restored list out of the mapped file first
+    static std::vector<BookId>& ownedList(PostingList& list) {
+        if (!list.mapped.empty()) {
+            list.owned.assign(list.mapped.begin(), list.mapped.end());
+            list.mapped = {};
+        }
+        return list.owned;
+    }
+
+    // Function to list the distinct trigrams of a book and bump their change counters
+    void bookGrams(std::string_view title, std::string_view author, std::vector<uint32_t>& grams) {
+        std::string folded;
+        foldInto(title, folded);
+        gramsOf(folded, grams);
+        foldInto(author, folded);
+        gramsOf(folded, grams);
+        std::sort(grams.begin(), grams.end());
+        grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+        for (uint32_t g : grams) {
+            stamps[stampOfGram(g)]++;
+        }
+    }
+
+    // Folded query and the trigrams its substring candidates come from. A query of two
+    // characters can only be matched as a prefix
+    static void queryGrams(std::string_view query, std::string& folded, std::vector<uint32_t>& grams) {
+        for (char c : query) {
+            folded.push_back(fold(c));
+        }
+        if (folded.size() >= 3) {
+            gramsOf(folded, grams);
+        }
+        else if (folded.size() == 2) {
+            gramsOf(marker + folded, grams);
+        }
+    }
+
+    // Posting lists longer than this are not used to generate fuzzy candidates
+    size_t fuzzyLimit() const { return std::min(maxFuzzyPostings, std::max<size_t>(1024, liveBooks / 64)); }
+
+    // Counts of trigrams shared with a fuzzy query, one per book. An entry is only valid where
+    // its stamp is the current query's, so the arrays are never cleared between queries
+    struct SharedCounts {
+        std::vector<uint32_t> stamp;
+        std::vector<uint8_t> count;
+        uint32_t query = 0;
+    };
+
+    // Function to get this thread's counts sized for books, stamped for a new query
+    static SharedCounts& sharedCounts(size_t books) {
+        thread_local SharedCounts counts;
+        if (counts.stamp.size() < books) {
+            counts.stamp.resize(books, 0);
+            counts.count.resize(books, 0);
+        }
+        if (++counts.query == 0) {
+            std::fill(counts.stamp.begin(), counts.stamp.end(), 0);
+            counts.query = 1;
+        }
+        return counts;
+    }
+
+    // Smallest edit distance between the query and any substring of the text (Sellers'
+    // algorithm), stopping early on an exact occurrence
+    static int substringDistance(std::string_view query, std::string_view text, std::vector<int>& row) {
+        row.resize(query.size() + 1);
+        for (size_t i = 0; i <= query.size(); i++) {
+            row[i] = static_cast<int>(i);
+        }
+        int best = row[query.size()];
+        for (char c : text) {
+            int diagonal = row[0];
+            row[0] = 0;
+            for (size_t i = 1; i <= query.size(); i++) {
+                int above = row[i];
+                int cost = query[i - 1] == c ? 0 : 1;
+                row[i] = std::min({ diagonal + cost, above + 1, row[i - 1] + 1 });
+                diagonal = above;
+            }
+            best = std::min(best, row[query.size()]);
+            if (best == 0) {
+                break;
+            }
+        }
+        return best;
+    }
+
+    // Function to keep only the candidates that are also in list. Both are sorted by ID; a small
+    // candidate set gallops through a long list instead of walking all of it
+    static void intersect(std::vector<BookId>& candidates, std::span<const BookId> list) {
+        size_t kept = 0;
+        auto from = list.begin();
+        bool gallop = candidates.size() * 16 < list.size();
+        for (BookId id : candidates) {
+            if (gallop) {
+                size_t step = 1;
+                auto probe = from;
+                while (probe != list.end() && *probe < id) {
+                    from = probe;
+                    probe = static_cast<size_t>(list.end() - probe) > step ? probe + static_cast<std::ptrdiff_t>(step) : list.end();
+                    step *= 2;
+                }
+                from = std::lower_bound(from, probe, id);
+            }
+            else {
+                while (from != list.end() && *from < id) {
+                    ++from;
+                }
+            }
+            if (from == list.end()) {
+                break;
+            }
+            if (*from == id) {
+                candidates[kept++] = id;
+            }
+        }
+        candidates.resize(kept);
+    }
+
+public:
+    // Posting lists longer than this, or than 1/64 of the catalog, are not used to generate
+    // fuzzy candidates
+    size_t maxFuzzyPostings = 20000;
+    // Edit distance checks a fuzzy query may spend before returning what it has
+    size_t maxFuzzyChecks = 1000;
+
+    // Function to index a book's title and author
+    void add(BookId id, std::string_view title, std::string_view author) {
+        std::vector<uint32_t> grams;
+        bookGrams(title, author, grams);
+        // Lists stay sorted by ID so queries can intersect them, new IDs normally go at the end
+        for (uint32_t g : grams) {
+            std::vector<BookId>& list = ownedList(postings[g]);
+            if (list.empty() || list.back() < id) {
+                list.push_back(id);
+            }
+            else {
+                list.insert(std::lower_bound(list.begin(), list.end(), id), id);
+            }
+        }
+        if (id >= indexed.size()) {
+            indexed.resize(static_cast<size_t>(id) + 1, 0);
+        }
+        indexed[id] = 1;
+        liveBooks++;
+        liveEntries += grams.size();
+    }
+
+    // Function to drop a book from the results, its posting entries are purged later. The title
+    // and author are those it was added with, their trigrams are the book's entries
+    void remove(BookId id, std::string_view title, std::string_view author) {
+        if (id >= indexed.size() || !indexed[id]) {
+            return;
+        }
+        std::vector<uint32_t> grams;
+        bookGrams(title, author, grams);
+        indexed[id] = 0;
+        liveBooks--;
+        liveEntries -= grams.size();
+        deadEntries += grams.size();
+        if (deadEntries > 1024 && deadEntries * 4 > liveEntries + deadEntries) {
+            purge();
+        }
+    }
+
+    // Function to remove every posting entry of removed books. Restored lists are only copied
+    // out if they hold one
+    void purge() {
+        auto dead = [this](BookId id) { return id >= indexed.size() || !indexed[id]; };
+        for (auto it = postings.begin(); it != postings.end();) {
+            std::span<const BookId> ids = it->second.ids();
+            if (std::any_of(ids.begin(), ids.end(), dead)) {
+                std::vector<BookId>& list = ownedList(it->second);
+                list.erase(std::remove_if(list.begin(), list.end(), dead), list.end());
+            }
+            it = it->second.ids().empty() ? postings.erase(it) : std::next(it);
+        }
+        deadEntries = 0;
+    }
+
+    // Function to call onList(gram, ids) for every posting list, the IDs sorted and possibly
+    // including removed books. For saving the index with a snapshot
+    template<typename OnList>
+    void forEachPosting(OnList onList) const {
+        for (const auto& [gram, list] : postings) {
+            onList(gram, list.ids());
+        }
+    }
+
+    // Returns true for a book that is indexed and not removed
+    bool contains(BookId id) const { return id < indexed.size() && indexed[id]; }
+
+    // Function to fill an empty index with saved posting lists of books 0 to books - 1, listAt(i)
+    // returning the (gram, IDs) pair of list i. The IDs are used in place, so their memory has
+    // to outlive the index; no title is read, which makes a restore cost per list rather than
+    // per book. Each list bumps its trigram's change counter like adding its books would.
+    // Returns false, leaving the index empty, if a list is not ascending or names another book
+    template<typename ListAt>
+    bool restore(BookId books, size_t lists, ListAt listAt) {
+        postings.reserve(lists);
+        for (size_t i = 0; i < lists; i++) {
+            auto [gram, ids] = listAt(i);
+            bool ordered = std::adjacent_find(ids.begin(), ids.end(), std::greater_equal<BookId>()) == ids.end();
+            if (!ordered || (!ids.empty() && ids.back() >= books)) {
+                postings.clear();
+                liveEntries = 0;
+                return false;
+            }
+            if (!ids.empty()) {
+                stamps[stampOfGram(gram)]++;
+                postings[gram].mapped = ids;
+                liveEntries += ids.size();
+            }
+        }
+        indexed.assign(books, 1);
+        liveBooks = books;
+        return true;
+    }
+
+    // Function to take the stamp of a query, see SearchStamp
+    SearchStamp stampOf(std::string_view query, int maxEdits) const {
+        SearchStamp stamp;
+        std::string folded;
+        std::vector<uint32_t> grams;
+        queryGrams(query, folded, grams);
+        for (uint32_t g : grams) {
+            stamp.grams += stamps[stampOfGram(g)];
+        }
+        if (maxEdits > 0 && folded.size() >= 4) {
+            stamp.fuzzyLimit = fuzzyLimit();
+        }
+        return stamp;
+    }
+
+    // Bytes held in memory, restored lists still in the mapped file are not counted
+    size_t memoryBytes() const {
+        size_t bytes = indexed.capacity() + stamps.capacity() * sizeof(uint32_t);
+        for (const auto& entry : postings) {
+            bytes += sizeof(entry) + entry.second.owned.capacity() * sizeof(BookId);
+        }
+        return bytes;
+    }
+
+    // Function to find the top k books for a query. lookup(id) returns the book (with title
+    // and author members) or nullptr. Exact, prefix and substring matches on the title rank
+    // ahead of author matches; only if nothing matches are titles within maxEdits typos returned
+    template<typename Lookup>
+    std::vector<SearchHit> search(std::string_view query, size_t k, int maxEdits, Lookup lookup) const {
+        std::vector<SearchHit> hits;
+        std::string folded, title, author;
+        std::vector<uint32_t> grams;
+        auto better = [](const SearchHit& a, const SearchHit& b) {
+            if (a.kind != b.kind) {
+                return a.kind < b.kind;
+            }
+            if (a.distance != b.distance) {
+                return a.distance < b.distance;
+            }
+            if (a.length != b.length) {
+                return a.length < b.length;
+            }
+            return a.id < b.id;
+        };
+        queryGrams(query, folded, grams);
+        if (folded.size() < 2 || k == 0) {
+            return hits;
+        }
+
+        // Substring candidates are the intersection of the posting lists of every query trigram,
+        // rarest first
+        std::vector<std::span<const BookId>> lists;
+        for (uint32_t g : grams) {
+            auto it = postings.find(g);
+            if (it == postings.end()) {
+                lists.clear();
+                break;
+            }
+            lists.push_back(it->second.ids());
+        }
+        std::sort(lists.begin(), lists.end(), [](const auto& a, const auto& b) { return a.size() < b.size() || (a.size() == b.size() && a.data() < b.data()); });
+        lists.erase(std::unique(lists.begin(), lists.end(), [](const auto& a, const auto& b) { return a.data() == b.data(); }), lists.end());
+
+        std::vector<BookId> candidates;
+        if (!lists.empty()) {
+            candidates.assign(lists[0].begin(), lists[0].end());
+            for (size_t i = 1; i < lists.size() && candidates.size() > 16; i++) {
+                intersect(candidates, lists[i]);
+            }
+        }
+
+        // Posting lists hold each book once in ID order, so the candidates are distinct and
+        // sorted; nothing per catalog is allocated to tell them apart. Every candidate is
+        // ranked and hits keeps the best k as a heap with the worst on top, so a broad query does
+        // not lose an exact title to books with lower IDs. Once the heap is full, a book whose
+        // best possible rank (from its title length and a prefix check) cannot beat the worst
+        // is skipped without folding its title and author
+        for (BookId id : candidates) {
+            if (hits.size() == k && hits.front().kind == MatchKind::ExactTitle) {
+                break;
+            }
+            if (id >= indexed.size() || !indexed[id]) {
+                continue;
+            }
+            const auto* book = lookup(id);
+            if (!book) {
+                continue;
+            }
+            if (hits.size() == k) {
+                std::string_view bookTitle = book->title;
+                bool prefix = bookTitle.size() >= folded.size() &&
+                    std::equal(folded.begin(), folded.end(), bookTitle.begin(), [](char q, char c) { return q == fold(c); });
+                MatchKind bestKind = !prefix ? MatchKind::TitleWordPrefix
+                    : bookTitle.size() == folded.size() ? MatchKind::ExactTitle : MatchKind::TitlePrefix;
+                if (!better({ id, bestKind, 0, bookTitle.size() }, hits.front())) {
+                    continue;
+                }
+            }
+            foldInto(book->title, title);
+            std::string_view titleText = std::string_view(title).substr(1);
+            size_t at = titleText.find(folded);
+            MatchKind kind;
+            if (at == 0) {
+                kind = titleText.size() == folded.size() ? MatchKind::ExactTitle : MatchKind::TitlePrefix;
+            }
+            else if (at != std::string_view::npos) {
+                kind = titleText[at - 1] == ' ' ? MatchKind::TitleWordPrefix : MatchKind::TitleSubstring;
+            }
+            else {
+                if (hits.size() == k && !better({ id, MatchKind::Author, 0, titleText.size() }, hits.front())) {
+                    continue;
+                }
+                foldInto(book->author, author);
+                if (std::string_view(author).substr(1).find(folded) == std::string_view::npos) {
+                    continue;
+                }
+                kind = MatchKind::Author;
+            }
+            SearchHit hit{ id, kind, 0, titleText.size() };
+            if (hits.size() < k) {
+                hits.push_back(hit);
+                std::push_heap(hits.begin(), hits.end(), better);
+            }
+            else if (better(hit, hits.front())) {
+                std::pop_heap(hits.begin(), hits.end(), better);
+                hits.back() = hit;
+                std::push_heap(hits.begin(), hits.end(), better);
+            }
+        }
+
+        // Fuzzy candidates share at least grams - 3 * maxEdits of the usable query trigrams
+        // (q-gram lemma). Very common trigrams carry little signal and are left out of the count
+        if (hits.empty() && maxEdits > 0 && folded.size() >= 4) {
+            grams.clear();
+            gramsOf(folded, grams);
+            std::sort(grams.begin(), grams.end());
+            grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+            // Trigrams shared per book are counted in per thread scratch that is stamped rather
+            // than cleared, so a query costs the entries it reads and not a pass over the
+            // catalog. Substring candidates were checked already
+            SharedCounts& shared = sharedCounts(indexed.size());
+            std::vector<BookId> touched;
+            size_t fuzzyPostings = fuzzyLimit();
+            int usable = 0;
+            for (uint32_t g : grams) {
+                auto it = postings.find(g);
+                if (it == postings.end()) {
+                    usable++;
+                    continue;
+                }
+                std::span<const BookId> ids = it->second.ids();
+                if (ids.size() > fuzzyPostings) {
+                    continue;
+                }
+                usable++;
+                for (BookId id : ids) {
+                    if (id >= indexed.size() || !indexed[id]) {
+                        continue;
+                    }
+                    if (shared.stamp[id] != shared.query) {
+                        if (std::binary_search(candidates.begin(), candidates.end(), id)) {
+                            continue;
+                        }
+                        shared.stamp[id] = shared.query;
+                        shared.count[id] = 0;
+                        touched.push_back(id);
+                    }
+                    if (shared.count[id] < 255) {
+                        shared.count[id]++;
+                    }
+                }
+            }
+            // Candidates sharing the most trigrams are checked first, and the search stops after
+            // the group of equally good candidates in which k close matches were found or once
+            // the check budget is spent
+            int needed = std::max(1, usable - 3 * maxEdits);
+            std::vector<std::vector<BookId>> byShared(256);
+            for (BookId id : touched) {
+                if (shared.count[id] >= needed) {
+                    byShared[shared.count[id]].push_back(id);
+                }
+            }
+            std::vector<int> row;
+            size_t fuzzyHits = 0, checks = 0;
+            for (int count = 255; count >= needed && fuzzyHits < k && checks < maxFuzzyChecks; count--) {
+                for (BookId id : byShared[count]) {
+                    if (++checks > maxFuzzyChecks) {
+                        break;
+                    }
+                    const auto* book = lookup(id);
+                    if (!book) {
+                        continue;
+                    }
+                    foldInto(book->title, title);
+                    int distance = substringDistance(folded, std::string_view(title).substr(1), row);
+                    if (distance <= maxEdits) {
+                        hits.push_back({ id, MatchKind::Fuzzy, distance, title.size() - 1 });
+                        fuzzyHits++;
+                    }
+                }
+            }
+        }
+
+        size_t top = std::min(k, hits.size());
+        std::partial_sort(hits.begin(), hits.begin() + static_cast<std::ptrdiff_t>(top), hits.end(), better);
+        hits.resize(top);
+        return hits;
+    }
+};
@@ -0,0 +1,124 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <shared_mutex>
+
+// Reader-writer lock split into shards on separate cache lines. A reader locks only the shard
+// of its own thread, so readers on different cores do not bounce one lock word between them;
+// a writer locks every shard in order. Usable with std::shared_lock and std::unique_lock.
+// Readers that find the lock taken are counted, so a long writer can step aside for them at
+// points where its work is consistent (see stepAside). A writer also holds a gate that readers
+// which change something besides the locked data take shared (see UpdateLock), so those stay
+// out until the writer is done, step asides included.
+class ShardedSharedMutex {
+private:
+    static const size_t shardCount = 16;
+
+    struct alignas(64) Shard {
+        std::shared_mutex mutex;
+    };
+    Shard shards[shardCount];
+    alignas(64) std::atomic<uint32_t> waitingReaders{ 0 };
+    std::shared_mutex writerGate;
+    std::mutex stepMutex;
+    std::condition_variable readersIn;
+
+    void lockShards() {
+        for (Shard& shard : shards) {
+            shard.mutex.lock();
+        }
+    }
+    void unlockShards() {
+        for (size_t i = shardCount; i > 0; i--) {
+            shards[i - 1].mutex.unlock();
+        }
+    }
+
+    // Threads are spread over the shards round robin and keep their shard for life
+    static size_t shardOfThread() {
+        static std::atomic<size_t> nextShard{ 0 };
+        thread_local size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % shardCount;
+        return shard;
+    }
+
+public:
+    ShardedSharedMutex() = default;
+    ShardedSharedMutex(const ShardedSharedMutex&) = delete;
+    ShardedSharedMutex& operator=(const ShardedSharedMutex&) = delete;
+
+    void lock() {
+        writerGate.lock();
+        lockShards();
+    }
+    bool try_lock() {
+        if (!writerGate.try_lock()) {
+            return false;
+        }
+        for (size_t i = 0; i < shardCount; i++) {
+            if (!shards[i].mutex.try_lock()) {
+                while (i > 0) {
+                    shards[--i].mutex.unlock();
+                }
+                writerGate.unlock();
+                return false;
+            }
+        }
+        return true;
+    }
+    void unlock() {
+        unlockShards();
+        writerGate.unlock();
+    }
+
+    void lock_shared() {
+        Shard& shard = shards[shardOfThread()];
+        if (!shard.mutex.try_lock_shared()) {
+            waitingReaders.fetch_add(1, std::memory_order_relaxed);
+            shard.mutex.lock_shared();
+            if (waitingReaders.fetch_sub(1, std::memory_order_relaxed) == 1) {
+                std::lock_guard<std::mutex> lock(stepMutex);
+                readersIn.notify_all();
+            }
+        }
+    }
+    bool try_lock_shared() { return shards[shardOfThread()].mutex.try_lock_shared(); }
+    void unlock_shared() { shards[shardOfThread()].mutex.unlock_shared(); }
+
+    // Returns true while a reader is blocked in lock_shared
+    bool readersWaiting() const { return waitingReaders.load(std::memory_order_relaxed) != 0; }
+
+    // Function for the writer holding the lock to let the blocked readers in once. It waits until
+    // they are all in or limit has passed, whichever is first, and locks again; the writer gate
+    // stays held throughout, so neither another writer nor an updating reader gets in meanwhile
+    template<typename Rep, typename Period>
+    void stepAside(std::chrono::duration<Rep, Period> limit) {
+        unlockShards();
+        {
+            std::unique_lock<std::mutex> lock(stepMutex);
+            readersIn.wait_for(lock, limit, [this] { return !readersWaiting(); });
+        }
+        lockShards();
+    }
+
+    // Shared lock for a reader that changes state of its own under it, such as loans. It waits
+    // for a writer that holds the gate, even while that writer steps aside for plain readers
+    class UpdateLock {
+    private:
+        ShardedSharedMutex& mutex;
+
+    public:
+        explicit UpdateLock(ShardedSharedMutex& mutex) : mutex(mutex) {
+            mutex.writerGate.lock_shared();
+            mutex.lock_shared();
+        }
+        ~UpdateLock() {
+            mutex.unlock_shared();
+            mutex.writerGate.unlock_shared();
+        }
+        UpdateLock(const UpdateLock&) = delete;
+        UpdateLock& operator=(const UpdateLock&) = delete;
+    };
+};
@@ -0,0 +1,154 @@
+#pragma once
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "LoanTable.h"
+
+// Handle to a slot map entry. The generation makes a handle to an erased entry stale even
+// after its slot has been reused
+struct SlotHandle {
+    uint32_t slot = NoId;
+    uint32_t generation = 0;
+};
+
+// Generational slot map: O(1) insert, lookup and erase through handles that stay valid while
+// entries move.
+//
+// Values are kept densely in insertion order. Erasing leaves a tombstone and frees the slot,
+// and once tombstones make up a quarter of the storage the live values are compacted in
+// order, so iteration stays dense and the amortized cost of an erase stays O(1). Pointers and
+// references to values are invalidated by insert and by compaction; handles are not.
+template<typename T>
+class SlotMap {
+private:
+    struct Slot {
+        uint32_t position; // index into values, or the next free slot while the slot is free
+        uint32_t generation;
+    };
+
+    std::vector<T> values;
+    std::vector<uint32_t> owners; // slot of each value, NoId for a tombstone
+    std::vector<Slot> slots;
+    uint32_t freeSlots = NoId;
+    size_t tombstones = 0;
+
+public:
+    // Iterates the live values in insertion order, skipping tombstones
+    template<typename Value, typename Map>
+    class Iterator {
+    private:
+        Map* map;
+        size_t position;
+
+        void skipTombstones() {
+            while (position < map->values.size() && map->owners[position] == NoId) {
+                position++;
+            }
+        }
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Value*;
+        using reference = Value&;
+
+        Iterator(Map* owner, size_t start) : map(owner), position(start) { skipTombstones(); }
+        reference operator*() const { return map->values[position]; }
+        pointer operator->() const { return &map->values[position]; }
+        Iterator& operator++() {
+            position++;
+            skipTombstones();
+            return *this;
+        }
+        bool operator==(const Iterator& other) const { return position == other.position; }
+        bool operator!=(const Iterator& other) const { return position != other.position; }
+    };
+    using iterator = Iterator<T, SlotMap>;
+    using const_iterator = Iterator<const T, const SlotMap>;
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, values.size()); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, values.size()); }
+
+    size_t size() const { return values.size() - tombstones; }
+    bool empty() const { return size() == 0; }
+
+    void reserve(size_t count) {
+        values.reserve(count);
+        owners.reserve(count);
+        slots.reserve(count);
+    }
+
+    // Function to add a value at the end of the iteration order, O(1) amortized
+    SlotHandle insert(T value) {
+        uint32_t slot;
+        if (freeSlots != NoId) {
+            slot = freeSlots;
+            freeSlots = slots[slot].position;
+        }
+        else {
+            slot = static_cast<uint32_t>(slots.size());
+            slots.push_back({ NoId, 0 });
+        }
+        slots[slot].position = static_cast<uint32_t>(values.size());
+        values.push_back(std::move(value));
+        owners.push_back(slot);
+        return { slot, slots[slot].generation };
+    }
+
+    // Function to find a value, nullptr if the handle is stale
+    T* get(SlotHandle handle) {
+        if (handle.slot >= slots.size() || slots[handle.slot].generation != handle.generation) {
+            return nullptr;
+        }
+        uint32_t position = slots[handle.slot].position;
+        return position < owners.size() && owners[position] == handle.slot ? &values[position] : nullptr;
+    }
+    const T* get(SlotHandle handle) const {
+        return const_cast<SlotMap*>(this)->get(handle);
+    }
+
+    // Function to access a value through a handle known to be live, without checking it
+    T& operator[](SlotHandle handle) { return values[slots[handle.slot].position]; }
+    const T& operator[](SlotHandle handle) const { return values[slots[handle.slot].position]; }
+
+    // Function to erase a value, O(1) amortized. Returns false if the handle is stale
+    bool erase(SlotHandle handle) {
+        if (!get(handle)) {
+            return false;
+        }
+        Slot& slot = slots[handle.slot];
+        values[slot.position] = T();
+        owners[slot.position] = NoId;
+        tombstones++;
+        slot.generation++;
+        slot.position = freeSlots;
+        freeSlots = handle.slot;
+        if (tombstones >= 64 && tombstones * 4 >= values.size()) {
+            compact();
+        }
+        return true;
+    }
+
+    // Function to drop the tombstones, keeping the live values in order
+    void compact() {
+        size_t kept = 0;
+        for (size_t position = 0; position < values.size(); position++) {
+            if (owners[position] == NoId) {
+                continue;
+            }
+            if (kept != position) {
+                values[kept] = std::move(values[position]);
+                owners[kept] = owners[position];
+            }
+            slots[owners[kept]].position = static_cast<uint32_t>(kept);
+            kept++;
+        }
+        values.resize(kept);
+        owners.resize(kept);
+        tombstones = 0;
+    }
+};
@@ -0,0 +1,245 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <system_error>
+#include "MappedFile.h"
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// On-disk layout of a binary library snapshot:
+//
+//   SnapshotHeader | SnapshotBook[bookCount] | SnapshotPatron[patronCount] | SnapshotLoan[loanCount]
+//   | title order u32[bookCount] | author order u32[bookCount] | GramPostings[gramCount]
+//   | postings u32[postingCount] | string bytes
+//
+// Strings are stored once in the trailing blob and referenced by (offset, size) relative to the
+// start of the blob, so a loader can map the file and read every record in place. The orders and
+// postings are the library's sorted views and search index by book position, so a loader can
+// take them over instead of sorting and indexing every title again; a writer may leave them out
+// (offset 0). Version 2 added the due time of each loan, version 3 the journal epoch of a
+// checkpoint and version 4 the views and index; older snapshots are still read without them.
+namespace snapshot {
+
+const char magic[8] = { 'B', 'E', 'R', 'R', 'Y', 'S', 'N', 'P' };
+const uint32_t version = 4;
+
+struct StringRef {
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t bookCount;
+    uint64_t patronCount;
+    uint64_t loanCount;
+    uint64_t booksOffset;
+    uint64_t patronsOffset;
+    uint64_t loansOffset;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+    uint64_t journalEpoch; // epoch of the journal that follows a checkpoint, see Journal
+    uint64_t titleOrderOffset;
+    uint64_t authorOrderOffset;
+    uint64_t gramCount;
+    uint64_t gramsOffset;
+    uint64_t postingCount;
+    uint64_t postingsOffset;
+};
+
+// Header size of each version, older headers end before the fields added later
+inline uint32_t headerSizeOf(uint32_t version) {
+    return version < 3 ? offsetof(Header, journalEpoch) : version < 4 ? offsetof(Header, titleOrderOffset) : sizeof(Header);
+}
+
+// The search index list of one trigram: count book positions from postings[first] on, ascending
+struct GramPostings {
+    uint32_t gram;
+    uint32_t count;
+    uint64_t first;
+};
+
+struct Book {
+    StringRef title;
+    StringRef author;
+    uint64_t checkedOut;
+};
+
+struct Patron {
+    StringRef firstName;
+    StringRef lastName;
+};
+
+// A loan refers to books and patrons by their position in the snapshot tables. due is a Unix
+// time, 0 when the snapshot predates due dates
+struct Loan {
+    uint32_t patron;
+    uint32_t book;
+    int64_t due;
+};
+
+// Loan record of version 1 snapshots
+struct LoanV1 {
+    uint32_t patron;
+    uint32_t book;
+};
+
+// Writes a snapshot to a temporary file that only replaces the target once it is complete
+// and flushed, so readers see either the old snapshot or the new one, never a partial file
+class Writer {
+private:
+    std::string target, tempFile;
+    FILE* file = nullptr;
+    bool failed = false;
+    bool durable;
+
+public:
+    // A durable writer syncs the file to disk before the rename, so a crash cannot leave a
+    // renamed but empty file
+    explicit Writer(const std::string& fileName, bool durable = true) : target(fileName), tempFile(fileName + ".tmp"), durable(durable) {
+        file = std::fopen(tempFile.c_str(), "wb");
+        failed = file == nullptr;
+        if (file) {
+            std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+        }
+    }
+    ~Writer() {
+        if (file) {
+            std::fclose(file);
+            std::remove(tempFile.c_str());
+        }
+    }
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    void write(const void* data, size_t size) {
+        if (!failed && size > 0 && std::fwrite(data, 1, size, file) != size) {
+            failed = true;
+        }
+    }
+    template<typename T>
+    void write(const T& value) { write(&value, sizeof(T)); }
+
+    // Function to flush the temporary file and atomically rename it over the target
+    bool commit() {
+        if (!file) {
+            return false;
+        }
+        failed = failed || std::fflush(file) != 0;
+#ifndef _WIN32
+        failed = failed || (durable && fsync(fileno(file)) != 0);
+#endif
+        std::fclose(file);
+        file = nullptr;
+        std::error_code ec;
+        if (!failed) {
+            std::filesystem::rename(tempFile, target, ec);
+        }
+        if (failed || ec) {
+            std::remove(tempFile.c_str());
+            return false;
+        }
+        return true;
+    }
+};
+
+// Read-only view over a mapped snapshot. open() validates the header and that every table
+// and string reference lies inside the file before any record is handed out
+class Reader {
+private:
+    MappedFile file;
+    const Header* header = nullptr;
+
+    // Division rather than count * size, which a corrupt header could overflow
+    bool inFile(uint64_t offset, uint64_t count, uint64_t size) const {
+        return offset <= file.size() && (count == 0 || (file.size() - offset) / count >= size);
+    }
+
+    uint64_t loanSize() const { return header->version == 1 ? sizeof(LoanV1) : sizeof(Loan); }
+
+public:
+    std::string error;
+
+    bool open(const std::string& fileName) {
+        if (!file.open(fileName)) {
+            error = "unable to open " + fileName;
+            return false;
+        }
+        if (file.size() < headerSizeOf(1)) {
+            error = "file is too small to be a snapshot";
+            return false;
+        }
+        header = reinterpret_cast<const Header*>(file.data());
+        if (std::memcmp(header->magic, magic, sizeof(magic)) != 0) {
+            error = "not a library snapshot";
+            return false;
+        }
+        if (header->version < 1 || header->version > version || header->headerSize != headerSizeOf(header->version)
+            || file.size() < header->headerSize) {
+            error = "unsupported snapshot version " + std::to_string(header->version);
+            return false;
+        }
+        if (!inFile(header->booksOffset, header->bookCount, sizeof(Book)) ||
+            !inFile(header->patronsOffset, header->patronCount, sizeof(Patron)) ||
+            !inFile(header->loansOffset, header->loanCount, loanSize()) ||
+            !inFile(header->stringsOffset, header->stringsSize, 1)) {
+            error = "snapshot is truncated";
+            return false;
+        }
+        if (header->version >= 4 && header->titleOrderOffset != 0 &&
+            (header->bookCount > UINT32_MAX || header->titleOrderOffset % 4 != 0 || header->authorOrderOffset % 4 != 0 ||
+            header->gramsOffset % 8 != 0 || header->postingsOffset % 4 != 0 ||
+            !inFile(header->titleOrderOffset, header->bookCount, sizeof(uint32_t)) ||
+            !inFile(header->authorOrderOffset, header->bookCount, sizeof(uint32_t)) ||
+            !inFile(header->gramsOffset, header->gramCount, sizeof(GramPostings)) ||
+            !inFile(header->postingsOffset, header->postingCount, sizeof(uint32_t)))) {
+            error = "snapshot index is truncated";
+            return false;
+        }
+        return true;
+    }
+
+    const Header& info() const { return *header; }
+    uint64_t journalEpoch() const { return header->version < 3 ? 0 : header->journalEpoch; }
+    bool hasIndexes() const { return header->version >= 4 && header->titleOrderOffset != 0; }
+    const uint32_t* titleOrder() const { return reinterpret_cast<const uint32_t*>(file.data() + header->titleOrderOffset); }
+    const uint32_t* authorOrder() const { return reinterpret_cast<const uint32_t*>(file.data() + header->authorOrderOffset); }
+    const GramPostings* grams() const { return reinterpret_cast<const GramPostings*>(file.data() + header->gramsOffset); }
+
+    // Function to get the book positions of a trigram's list, empty if it points outside the postings
+    std::span<const uint32_t> postings(const GramPostings& gram) const {
+        if (gram.first > header->postingCount || gram.count > header->postingCount - gram.first) {
+            return {};
+        }
+        return { reinterpret_cast<const uint32_t*>(file.data() + header->postingsOffset) + gram.first, gram.count };
+    }
+    const Book* books() const { return reinterpret_cast<const Book*>(file.data() + header->booksOffset); }
+    const Patron* patrons() const { return reinterpret_cast<const Patron*>(file.data() + header->patronsOffset); }
+
+    // Function to read a loan record of either version
+    Loan loan(uint64_t index) const {
+        const char* record = file.data() + header->loansOffset + index * loanSize();
+        Loan loan{};
+        std::memcpy(&loan, record, static_cast<size_t>(loanSize()));
+        return loan;
+    }
+
+    // Returns false if the reference points outside the string blob
+    bool valid(const StringRef& ref) const {
+        return ref.offset <= header->stringsSize && ref.size <= header->stringsSize - ref.offset;
+    }
+    std::string_view str(const StringRef& ref) const {
+        return std::string_view(file.data() + header->stringsOffset + ref.offset, static_cast<size_t>(ref.size));
+    }
+};
+
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <cstdint>
+#include <set>
+#include <span>
+#include <vector>
+#include <string_view>
+#include <utility>
+#include <algorithm>
+#include <future>
+#include <thread>
+#include "LoanTable.h"
+
+// Function to sort on every hardware thread: equal chunks are sorted concurrently and then
+// merged pairwise, the merges of one round also running concurrently
+template<typename T, typename Less>
+void parallelSort(std::vector<T>& items, Less less) {
+    const size_t minChunk = 1 << 14;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t chunks = std::min(threads, items.size() / minChunk);
+    if (chunks < 2) {
+        std::sort(items.begin(), items.end(), less);
+        return;
+    }
+    auto at = [&items](size_t pos) { return items.begin() + static_cast<std::ptrdiff_t>(pos); };
+    std::vector<size_t> bounds(chunks + 1);
+    for (size_t i = 0; i <= chunks; i++) {
+        bounds[i] = items.size() * i / chunks;
+    }
+    std::vector<std::future<void>> jobs;
+    for (size_t i = 1; i < chunks; i++) {
+        jobs.push_back(std::async(std::launch::async, [&, i] { std::sort(at(bounds[i]), at(bounds[i + 1]), less); }));
+    }
+    std::sort(at(bounds[0]), at(bounds[1]), less);
+    for (auto& job : jobs) {
+        job.get();
+    }
+    for (size_t width = 1; width < chunks; width *= 2) {
+        jobs.clear();
+        for (size_t i = 0; i + width < chunks; i += 2 * width) {
+            size_t first = bounds[i], middle = bounds[i + width], last = bounds[std::min(i + 2 * width, chunks)];
+            jobs.push_back(std::async(std::launch::async, [&, first, middle, last] {
+                std::inplace_merge(at(first), at(middle), at(last), less);
+                }));
+        }
+        for (auto& job : jobs) {
+            job.get();
+        }
+    }
+}
+
+// Book IDs kept ordered by a string key such as the title or the author, ties broken by ID so
+// equal keys stay in the order the books were added. The view holds only IDs and reads keys
+// through keyOf(id), so a book has to leave the view before its record is removed.
+template<typename KeyOf>
+class SortedView {
+private:
+    struct Less {
+        using is_transparent = void;
+        const KeyOf* keyOf;
+        bool operator()(BookId a, BookId b) const {
+            int compared = (*keyOf)(a).compare((*keyOf)(b));
+            return compared < 0 || (compared == 0 && a < b);
+        }
+        // A bare key sorts before every book with that key, for prefix lookups
+        bool operator()(BookId a, std::string_view key) const { return (*keyOf)(a) < key; }
+        bool operator()(std::string_view key, BookId b) const { return key <= (*keyOf)(b); }
+    };
+
+    KeyOf keyOf;
+    std::set<BookId, Less> order;
+
+public:
+    explicit SortedView(KeyOf key) : keyOf(key), order(Less{ &keyOf }) {}
+    SortedView(const SortedView&) = delete;
+    SortedView& operator=(const SortedView&) = delete;
+
+    // Function to add a book, O(log n)
+    void insert(BookId id) { order.insert(id); }
+    // Function to remove a book while its key can still be read, O(log n)
+    void erase(BookId id) { order.erase(id); }
+
+    // Function to replace the view with these books. Keys are read once and sorted in parallel
+    // next to their IDs, the tree is then built from the sorted run in linear time
+    void rebuild(const std::vector<BookId>& ids) {
+        std::vector<std::pair<std::string_view, BookId>> keyed;
+        keyed.reserve(ids.size());
+        for (BookId id : ids) {
+            keyed.emplace_back(keyOf(id), id);
+        }
+        parallelSort(keyed, [](const auto& a, const auto& b) {
+            int compared = a.first.compare(b.first);
+            return compared < 0 || (compared == 0 && a.second < b.second);
+            });
+        order.clear();
+        for (const auto& entry : keyed) {
+            order.insert(order.end(), entry.second);
+        }
+    }
+
+    // Function to replace the view with books already in view order, such as a saved view, in
+    // linear time. Returns false and leaves the view empty if they are out of order
+    bool assignSorted(std::span<const BookId> ids) {
+        order.clear();
+        for (BookId id : ids) {
+            if (!order.empty() && !order.key_comp()(*order.rbegin(), id)) {
+                order.clear();
+                return false;
+            }
+            order.insert(order.end(), id);
+        }
+        return true;
+    }
+
+    // Function to call onId(id) for every book whose key starts with prefix, in order. Finds the
+    // first one in O(log n), matching case
+    template<typename OnId>
+    void forEachWithPrefix(std::string_view prefix, OnId onId) const {
+        for (auto it = order.lower_bound(prefix); it != order.end() && keyOf(*it).starts_with(prefix); ++it) {
+            onId(*it);
+        }
+    }
+
+    size_t size() const { return order.size(); }
+    auto begin() const { return order.begin(); }
+    auto end() const { return order.end(); }
+};
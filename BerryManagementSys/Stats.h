@@ -0,0 +1,141 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Operations with their own latency histogram
+enum class StatOp : uint8_t {
+    SearchTitle, SearchAuthor, SearchPartial, AddBook, RemoveBook, CheckOut, Return,
+    SortedList, ReadFile, WriteFile, WriteSnapshot, Import, PublishImage, BulkCirculation, Count
+};
+
+inline const char* statOpName(StatOp op) {
+    static const char* const names[] = { "search title", "search author", "search partial", "add book", "remove book",
+        "checkout", "return", "sorted list", "read file", "write file", "write snapshot", "import",
+        "publish image", "bulk circulation" };
+    return names[static_cast<size_t>(op)];
+}
+
+// Latency histogram with HDR-style log-linear buckets: every power of two range of
+// nanoseconds is split into 16 buckets, so a recorded value is off by at most 1/16. Recording
+// is a few relaxed atomic adds and safe from any thread.
+class LatencyHistogram {
+private:
+    static const int subBits = 4;
+    static const size_t subCount = 1 << subBits;
+    static const int maxExponent = 47; // about 39 hours
+    static const size_t bucketCount = subCount * (maxExponent - subBits + 2);
+
+    std::atomic<uint64_t> buckets[bucketCount] = {};
+    std::atomic<uint64_t> total{ 0 }, sum{ 0 }, largest{ 0 };
+
+    static size_t bucketOf(uint64_t value) {
+        if (value < subCount) {
+            return static_cast<size_t>(value);
+        }
+        int exponent = std::bit_width(value) - 1;
+        if (exponent > maxExponent) {
+            return bucketCount - 1;
+        }
+        return subCount * static_cast<size_t>(exponent - subBits + 1) + static_cast<size_t>(value >> (exponent - subBits)) - subCount;
+    }
+
+    // Middle of the range of values that land in a bucket
+    static uint64_t valueOf(size_t bucket) {
+        if (bucket < subCount) {
+            return bucket;
+        }
+        int exponent = static_cast<int>(bucket / subCount) + subBits - 1;
+        uint64_t low = static_cast<uint64_t>(subCount + bucket % subCount) << (exponent - subBits);
+        return low + (uint64_t(1) << (exponent - subBits)) / 2;
+    }
+
+public:
+    void record(uint64_t nanoseconds) {
+        buckets[bucketOf(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+        uint64_t seen = largest.load(std::memory_order_relaxed);
+        while (nanoseconds > seen && !largest.compare_exchange_weak(seen, nanoseconds, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t max() const { return largest.load(std::memory_order_relaxed); }
+    double mean() const {
+        uint64_t n = count();
+        return n ? static_cast<double>(sum.load(std::memory_order_relaxed)) / n : 0.0;
+    }
+
+    // Function to estimate the value below which a fraction q of the recorded values fall
+    uint64_t percentile(double q) const {
+        uint64_t n = count();
+        if (n == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(q * n), seen = 0;
+        for (size_t bucket = 0; bucket < bucketCount; bucket++) {
+            seen += buckets[bucket].load(std::memory_order_relaxed);
+            if (seen > rank) {
+                return bucket == bucketCount - 1 ? max() : std::min(valueOf(bucket), max());
+            }
+        }
+        return max();
+    }
+};
+
+// Per-operation latency histograms and per-command counters. Building with BERRY_NO_STATS
+// leaves empty classes whose calls compile away.
+#ifndef BERRY_NO_STATS
+class Stats {
+private:
+    LatencyHistogram ops[static_cast<size_t>(StatOp::Count)];
+    std::atomic<uint64_t> commands[128] = {};
+
+public:
+    static constexpr bool enabled = true;
+
+    void record(StatOp op, uint64_t nanoseconds) { ops[static_cast<size_t>(op)].record(nanoseconds); }
+    void countCommand(char command) {
+        commands[static_cast<unsigned char>(command) & 127].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const LatencyHistogram& op(StatOp which) const { return ops[static_cast<size_t>(which)]; }
+    uint64_t commandCount(char command) const {
+        return commands[static_cast<unsigned char>(command) & 127].load(std::memory_order_relaxed);
+    }
+};
+
+// Records the time until the end of the scope
+class StatTimer {
+private:
+    Stats& stats;
+    StatOp op;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    StatTimer(Stats& target, StatOp which) : stats(target), op(which), start(std::chrono::steady_clock::now()) {}
+    ~StatTimer() {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        stats.record(op, static_cast<uint64_t>(elapsed.count()));
+    }
+    StatTimer(const StatTimer&) = delete;
+    StatTimer& operator=(const StatTimer&) = delete;
+};
+#else
+class Stats {
+public:
+    static constexpr bool enabled = false;
+
+    void record(StatOp, uint64_t) {}
+    void countCommand(char) {}
+};
+
+class StatTimer {
+public:
+    StatTimer(Stats&, StatOp) {}
+};
+#endif
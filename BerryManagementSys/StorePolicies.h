@@ -0,0 +1,204 @@
+#pragma once
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "SlotMap.h"
+
+// Container roles of the Library template. Any type that models the concept of its role can be
+// plugged in at compile time; SlotMap, DequeStore and FlatStore are the shipped book and patron
+// stores.
+
+// A handle store owns values and hands out a handle for each one. get() returns nullptr for a
+// handle whose value has been erased, operator[] may assume the handle is live. Iterating
+// visits the live values in insertion order. Handles must stay valid while other values are
+// inserted and erased; pointers and references need not
+template<typename Store, typename T>
+concept HandleStore = requires(Store store, const Store& constStore, T value, SlotHandle handle) {
+    { store.insert(std::move(value)) } -> std::same_as<SlotHandle>;
+    { store.get(handle) } -> std::same_as<T*>;
+    { constStore.get(handle) } -> std::same_as<const T*>;
+    { constStore[handle] } -> std::same_as<const T&>;
+    { store.erase(handle) } -> std::same_as<bool>;
+    { constStore.size() } -> std::convertible_to<size_t>;
+    { *constStore.begin() } -> std::same_as<const T&>;
+    { constStore.begin() != constStore.end() } -> std::convertible_to<bool>;
+};
+
+// An append store only ever has records added to it
+template<typename Store, typename T>
+concept AppendStore = requires(Store store, T value) {
+    store.push_back(std::move(value));
+};
+
+// Function to reserve room in a container that supports it
+template<typename Container>
+void reserveIfSupported(Container& container, size_t count) {
+    if constexpr (requires { container.reserve(count); }) {
+        container.reserve(count);
+    }
+}
+
+// Book store over a std::deque. Values never move, so growing never copies the catalog and
+// there is no slot table: a handle is the position of its value. Erasing leaves a tombstone
+// and tombstones are only reclaimed from the front, so a catalog that churns in the middle
+// keeps paying for them in memory and in iteration.
+template<typename T>
+class DequeStore {
+private:
+    std::deque<T> values;
+    std::deque<uint8_t> live;
+    uint32_t base = 0; // handle slot of values.front()
+    size_t tombstones = 0;
+
+public:
+    // Iterates the live values in insertion order, skipping tombstones
+    template<typename Value, typename Store>
+    class Iterator {
+    private:
+        Store* store;
+        size_t position;
+
+        void skipTombstones() {
+            while (position < store->values.size() && !store->live[position]) {
+                position++;
+            }
+        }
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Value*;
+        using reference = Value&;
+
+        Iterator(Store* owner, size_t start) : store(owner), position(start) { skipTombstones(); }
+        reference operator*() const { return store->values[position]; }
+        pointer operator->() const { return &store->values[position]; }
+        Iterator& operator++() {
+            position++;
+            skipTombstones();
+            return *this;
+        }
+        bool operator==(const Iterator& other) const { return position == other.position; }
+        bool operator!=(const Iterator& other) const { return position != other.position; }
+    };
+    using iterator = Iterator<T, DequeStore>;
+    using const_iterator = Iterator<const T, const DequeStore>;
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, values.size()); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, values.size()); }
+
+    size_t size() const { return values.size() - tombstones; }
+    bool empty() const { return size() == 0; }
+
+    // Function to add a value at the end, O(1) and without moving any other value
+    SlotHandle insert(T value) {
+        values.push_back(std::move(value));
+        live.push_back(1);
+        return { base + static_cast<uint32_t>(values.size() - 1), 0 };
+    }
+
+    // Function to find a value, nullptr if it has been erased
+    T* get(SlotHandle handle) {
+        size_t position = handle.slot - base;
+        return handle.slot >= base && position < values.size() && live[position] ? &values[position] : nullptr;
+    }
+    const T* get(SlotHandle handle) const {
+        return const_cast<DequeStore*>(this)->get(handle);
+    }
+
+    // Function to access a value through a handle known to be live, without checking it
+    T& operator[](SlotHandle handle) { return values[handle.slot - base]; }
+    const T& operator[](SlotHandle handle) const { return values[handle.slot - base]; }
+
+    // Function to erase a value, O(1). Returns false if it was already erased
+    bool erase(SlotHandle handle) {
+        T* value = get(handle);
+        if (!value) {
+            return false;
+        }
+        *value = T();
+        live[handle.slot - base] = 0;
+        tombstones++;
+        while (!values.empty() && !live.front()) {
+            values.pop_front();
+            live.pop_front();
+            tombstones--;
+            base++;
+        }
+        return true;
+    }
+};
+
+// Flat book store: the values in one vector in insertion order and a parallel sorted vector of
+// their keys, like a flat map. Lookups binary search the keys, so there is no slot table and a
+// value costs four bytes of bookkeeping, and iteration is a plain walk over the vector. Erasing
+// shifts the tail of both vectors down, O(n), so the store suits catalogs that are read far
+// more than they change.
+template<typename T>
+class FlatStore {
+private:
+    std::vector<uint32_t> keys; // ascending, a key is never reused
+    std::vector<T> values;
+    uint32_t nextKey = 0;
+
+    // Function to find the position of a key, values.size() if it is not stored
+    size_t positionOf(uint32_t key) const {
+        auto it = std::lower_bound(keys.begin(), keys.end(), key);
+        return it != keys.end() && *it == key ? static_cast<size_t>(it - keys.begin()) : values.size();
+    }
+
+public:
+    using iterator = typename std::vector<T>::iterator;
+    using const_iterator = typename std::vector<T>::const_iterator;
+
+    iterator begin() { return values.begin(); }
+    iterator end() { return values.end(); }
+    const_iterator begin() const { return values.begin(); }
+    const_iterator end() const { return values.end(); }
+
+    size_t size() const { return values.size(); }
+    bool empty() const { return values.empty(); }
+
+    void reserve(size_t count) {
+        keys.reserve(count);
+        values.reserve(count);
+    }
+
+    // Function to add a value at the end. Keys only grow, so the keys stay sorted
+    SlotHandle insert(T value) {
+        keys.push_back(nextKey);
+        values.push_back(std::move(value));
+        return { nextKey++, 0 };
+    }
+
+    // Function to find a value in O(log n), nullptr if it has been erased
+    T* get(SlotHandle handle) {
+        size_t position = positionOf(handle.slot);
+        return position < values.size() ? &values[position] : nullptr;
+    }
+    const T* get(SlotHandle handle) const {
+        return const_cast<FlatStore*>(this)->get(handle);
+    }
+
+    T& operator[](SlotHandle handle) { return values[positionOf(handle.slot)]; }
+    const T& operator[](SlotHandle handle) const { return values[positionOf(handle.slot)]; }
+
+    // Function to erase a value, O(n). Returns false if it was already erased
+    bool erase(SlotHandle handle) {
+        size_t position = positionOf(handle.slot);
+        if (position == values.size()) {
+            return false;
+        }
+        keys.erase(keys.begin() + static_cast<std::ptrdiff_t>(position));
+        values.erase(values.begin() + static_cast<std::ptrdiff_t>(position));
+        return true;
+    }
+};
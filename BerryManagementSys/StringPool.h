@@ -0,0 +1,75 @@
+#pragma once
+#include <cctype>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Append-only arena for strings that live as long as their owner. Strings are copied back to
+// back into 64 KB blocks, so storing one is a bump of a pointer and a block allocation every
+// few thousand strings. Views stay valid for the life of the pool: blocks never move and
+// nothing is freed before the pool is. The pool does not look for repeats, callers that know
+// a string is stored already reuse its view instead.
+class StringPool {
+private:
+    static const size_t blockSize = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char* cursor = nullptr;
+    size_t left = 0;
+    size_t blockBytes = 0, storedBytes = 0, storedCount = 0;
+
+    // Function to make room for size bytes and return where they go. Strings longer than a
+    // quarter block get a block of their own so they do not waste the rest of the current one
+    char* allocate(size_t size) {
+        storedBytes += size;
+        storedCount++;
+        if (size > blockSize / 4) {
+            blocks.push_back(std::make_unique<char[]>(size));
+            blockBytes += size;
+            return blocks.back().get();
+        }
+        if (size > left) {
+            blocks.push_back(std::make_unique<char[]>(blockSize));
+            blockBytes += blockSize;
+            cursor = blocks.back().get();
+            left = blockSize;
+        }
+        char* at = cursor;
+        cursor += size;
+        left -= size;
+        return at;
+    }
+
+public:
+    StringPool() = default;
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    // Function to copy text into the pool
+    std::string_view store(std::string_view text) {
+        if (text.empty()) {
+            return {};
+        }
+        char* at = allocate(text.size());
+        std::memcpy(at, text.data(), text.size());
+        return { at, text.size() };
+    }
+
+    // Function to copy text into the pool in lowercase
+    std::string_view storeFolded(std::string_view text) {
+        if (text.empty()) {
+            return {};
+        }
+        char* at = allocate(text.size());
+        for (size_t i = 0; i < text.size(); i++) {
+            at[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(text[i])));
+        }
+        return { at, text.size() };
+    }
+
+    size_t size() const { return storedCount; }
+    size_t bytes() const { return storedBytes; }
+    size_t memoryBytes() const { return blockBytes + blocks.capacity() * sizeof(void*); }
+};
@@ -0,0 +1,178 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Hierarchical timer wheel over small integer IDs, such as loan slots.
+//
+// Four levels of 64 slots at one-minute ticks cover about 32 years; deadlines further out wait
+// in the top level and are placed again when it turns. Every slot is an intrusive doubly linked
+// list threaded through a table indexed by ID, so scheduling and cancelling are O(1) and the
+// wheel allocates nothing per timer. Advancing the clock walks only the slots that come due and,
+// once per 64 ticks of a level, spreads one slot of that level over the level below. Timers that
+// fire move to an overdue list, kept in the order they fell due, until they are cancelled.
+class TimerWheel {
+public:
+    static const int64_t resolution = 60; // seconds per tick
+
+private:
+    static const int slotBits = 6;
+    static const int levels = 4;
+    static const uint32_t slots = 1u << slotBits;
+    static const uint32_t overdueList = levels * slots;
+    static const uint32_t none = UINT32_MAX;
+    static const uint16_t unscheduled = UINT16_MAX;
+
+    struct Node {
+        uint32_t prev;
+        uint32_t next;
+        int64_t deadline;
+        uint16_t list;
+    };
+
+    std::vector<Node> nodes;
+    uint32_t heads[levels * slots + 1];
+    uint32_t overdueTail = none;
+    int64_t current; // last tick processed
+    size_t pending = 0, overdue = 0;
+
+    void link(uint32_t id, uint32_t list) {
+        Node& node = nodes[id];
+        node.list = static_cast<uint16_t>(list);
+        node.prev = none;
+        if (list == overdueList) {
+            // Appended so the list stays in the order loans fell due
+            node.prev = overdueTail;
+            node.next = none;
+            if (overdueTail != none) {
+                nodes[overdueTail].next = id;
+            }
+            else {
+                heads[list] = id;
+            }
+            overdueTail = id;
+            return;
+        }
+        node.next = heads[list];
+        if (node.next != none) {
+            nodes[node.next].prev = id;
+        }
+        heads[list] = id;
+    }
+
+    void unlink(uint32_t id) {
+        Node& node = nodes[id];
+        if (node.prev != none) {
+            nodes[node.prev].next = node.next;
+        }
+        else {
+            heads[node.list] = node.next;
+        }
+        if (node.next != none) {
+            nodes[node.next].prev = node.prev;
+        }
+        else if (node.list == overdueList) {
+            overdueTail = node.prev;
+        }
+        node.list = unscheduled;
+    }
+
+    // Function to put a timer in the slot of its tick, no earlier than earliest
+    void place(uint32_t id, int64_t earliest) {
+        int64_t tick = std::max((nodes[id].deadline + resolution - 1) / resolution, earliest);
+        int64_t delta = tick - current;
+        int level = 0;
+        while (level < levels - 1 && delta >= (int64_t(1) << (slotBits * (level + 1)))) {
+            level++;
+        }
+        // Past the top level's reach the timer waits in its farthest slot
+        tick = std::min(tick, current + (int64_t(1) << (slotBits * levels)) - 1);
+        link(id, static_cast<uint32_t>(level) * slots + static_cast<uint32_t>((tick >> (slotBits * level)) & (slots - 1)));
+    }
+
+    // Function to move every timer of a level 0 slot to the overdue list
+    template<typename OnDue>
+    void expire(uint32_t list, OnDue& onDue) {
+        uint32_t id = heads[list];
+        heads[list] = none;
+        while (id != none) {
+            uint32_t next = nodes[id].next;
+            link(id, overdueList);
+            pending--;
+            overdue++;
+            onDue(id);
+            id = next;
+        }
+    }
+
+public:
+    // Function to start the clock at a Unix time
+    explicit TimerWheel(int64_t now) : current(now / resolution) {
+        std::fill(std::begin(heads), std::end(heads), none);
+    }
+
+    size_t scheduled() const { return pending; }
+    size_t overdueCount() const { return overdue; }
+    int64_t deadline(uint32_t id) const { return nodes[id].deadline; }
+    bool isOverdue(uint32_t id) const { return id < nodes.size() && nodes[id].list == overdueList; }
+
+    // Function to set a timer for a Unix time, replacing any timer the ID already has. A time
+    // already past falls due at the next advance
+    void schedule(uint32_t id, int64_t deadline) {
+        if (id >= nodes.size()) {
+            nodes.resize(static_cast<size_t>(id) + 1, Node{ none, none, 0, unscheduled });
+        }
+        cancel(id);
+        nodes[id].deadline = deadline;
+        place(id, current);
+        pending++;
+    }
+
+    // Function to drop the timer of an ID, whether it is still waiting or overdue
+    void cancel(uint32_t id) {
+        if (id >= nodes.size() || nodes[id].list == unscheduled) {
+            return;
+        }
+        (nodes[id].list == overdueList ? overdue : pending)--;
+        unlink(id);
+    }
+
+    // Function to move the clock to a Unix time, calling onDue(id) for every timer that falls due
+    template<typename OnDue>
+    void advance(int64_t now, OnDue onDue) {
+        int64_t target = now / resolution;
+        // The slot of the current tick only holds timers scheduled after it was processed
+        expire(static_cast<uint32_t>(current & (slots - 1)), onDue);
+        while (current < target) {
+            if (pending == 0) {
+                current = target;
+                break;
+            }
+            current++;
+            // Each level that wrapped hands its next slot down, the highest first
+            int wrapped = 0;
+            while (wrapped + 1 < levels && (current & ((int64_t(1) << (slotBits * (wrapped + 1))) - 1)) == 0) {
+                wrapped++;
+            }
+            for (int level = wrapped; level >= 1; level--) {
+                uint32_t list = static_cast<uint32_t>(level) * slots + static_cast<uint32_t>((current >> (slotBits * level)) & (slots - 1));
+                uint32_t id = heads[list];
+                heads[list] = none;
+                while (id != none) {
+                    uint32_t next = nodes[id].next;
+                    place(id, current);
+                    id = next;
+                }
+            }
+            expire(static_cast<uint32_t>(current & (slots - 1)), onDue);
+        }
+    }
+
+    // Function to call onOverdue(id) for every overdue timer, in the order they fell due
+    template<typename OnOverdue>
+    void forEachOverdue(OnOverdue onOverdue) const {
+        for (uint32_t id = heads[overdueList]; id != none; id = nodes[id].next) {
+            onOverdue(id);
+        }
+    }
+};